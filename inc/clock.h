@@ -12,10 +12,34 @@
 void initOSCs(void);
 
 void initSystemTimer(void);
-uint64_t getSystemTime(void);
 
-void quickTimeInit(void);
-void quickTimeFireIn(uint16_t millis, void (*callback)(void));
+// all read the 4MHz hardware counter atomically
+uint64_t getSystemTime(void); // milliseconds since reset
+uint32_t getSystemMicros(void); // wraps every 71.6 minutes
+uint32_t getSystemCycles(void); // CPU cycles in steps of 8, wraps every 134s
+
+typedef void (*TimerCallback)(void);
+
+// Software timers with 1ms delays. Callbacks run in the compare ISR,
+// or from timerLoop() in the main loop when started with TIMER_DEFERRED.
+// Expired timers run in deadline order. When started from a callback in the
+// ISR, the delay counts from that callback's deadline. Deferred callbacks run
+// with interrupts enabled, timers started from them count from now.
+#define TIMER_SLOTS 8
+#define TIMER_INVALID 0xFF
+#define TIMER_DEFERRED (1 << 0)
+
+// returns a timer id, or TIMER_INVALID if all slots are in use
+uint8_t timerStart(uint32_t millis, TimerCallback callback, uint8_t flags);
+void timerCancel(uint8_t id);
+void timerLoop(void);
+
+// One-shot on TimerE0 with microsecond resolution. The callback runs at
+// high interrupt level. When called from the callback, the delay counts
+// from the previous deadline, so chained deadlines don't accumulate latency.
+void preciseTimeInit(void);
+void preciseTimeFireIn(uint32_t millis, uint16_t micros, TimerCallback callback);
+void preciseTimeCancel(void);
 
 #endif // __CLOCK_H__
 
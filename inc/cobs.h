@@ -0,0 +1,39 @@
+/*
+ * cobs.h
+ * avr_pump_board
+ *
+ * Consistent Overhead Byte Stuffing and CRC16 (XMODEM) for the binary
+ * protocol. Plain C without AVR dependencies, so it can be built on the host.
+ *
+ * Copyright (c) 2017 Thomas Buck <xythobuz@xythobuz.de>
+ * All rights reserved.
+ */
+
+#ifndef __COBS_H__
+#define __COBS_H__
+
+#include <stdint.h>
+
+// Worst-case encoded size of n bytes, excluding the 0x00 delimiter
+#define COBS_ENCODED_SIZE(n) ((n) + ((n) / 254) + 1)
+
+/*
+ * Encode len bytes from src into dst, which has to hold at least
+ * COBS_ENCODED_SIZE(len) bytes. The result contains no 0x00 bytes,
+ * the delimiter is not appended. Returns the encoded length.
+ */
+uint16_t cobsEncode(const uint8_t *src, uint16_t len, uint8_t *dst);
+
+/*
+ * Decode len bytes from src (without delimiter) into dst. The output is
+ * never longer than the input, so decoding in-place (dst == src) works.
+ * Returns the decoded length, or 0 if the input is malformed.
+ */
+uint16_t cobsDecode(const uint8_t *src, uint16_t len, uint8_t *dst);
+
+// CRC16, polynomial 0x1021, initial value 0 (XMODEM)
+uint16_t crc16Update(uint16_t crc, uint8_t data);
+uint16_t crc16(const uint8_t *data, uint16_t len);
+
+#endif // __COBS_H__
+
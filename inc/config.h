@@ -13,6 +13,12 @@
 #define VERSION_ID "v3.0"
 #define AUTHOR_ID "xythobuz.de"
 
+// baudrate of the host link after reset
+#define HOST_BAUDRATE 38400
+
+// return to the old baudrate if no line arrives at a new one in this time (ms)
+#define BAUDRATE_FALLBACK_TIMEOUT 1000
+
 //#define DISABLE_SERIAL_ECHO
 #define COMMANDLINE_STRING "?> "
 #define COMMAND_PREFIX ""
@@ -20,8 +26,21 @@
 // doesn't need to be larger than pump count
 #define RECIPE_MAX_INGREDIENTS 20
 
+// recipes that can be entered independently and dispensed at the same
+// time, as long as they use different pumps. at most 8.
+#define RECIPE_SLOTS 2
+
+// power budget of all recipes, pumps are started later when it is exhausted.
+// by default every pump counts as 1, so all 20 may run at once.
+#define PUMP_WEIGHT_DEFAULT 1
+#define PUMP_BUDGET_DEFAULT 20
+
 // switch all pumps in the span of 1000ms when cleaning
 #define PUMP_CLEAN_DELAY (1000 / 20)
 
+// play recipes with TCD0 and DMA channel 0 while the WS2812 strip is idle.
+// the TCE0 one-shot timer is used when this is disabled or the channel is busy.
+#define PUMPS_DMA
+
 #endif // __CONFIG_H__
 
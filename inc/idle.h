@@ -0,0 +1,33 @@
+/*
+ * idle.h
+ * avr_pump_board
+ *
+ * Puts the CPU to sleep while the main loop has nothing to do.
+ *
+ * Copyright (c) 2017 Thomas Buck <xythobuz@xythobuz.de>
+ * All rights reserved.
+ */
+
+#ifndef __IDLE_H__
+#define __IDLE_H__
+
+typedef struct {
+    uint32_t elapsed; // ms since the last reset
+    uint32_t asleep; // ms of that spent sleeping
+    uint32_t wakeups;
+    uint32_t latencyAverage; // us from a wake-up source to the main loop
+    uint32_t latencyMax;
+} IdleStatistics;
+
+void idleInit(void);
+
+// Sleeps until an interrupt wakes us, returns at once if there is work left
+void idleSleep(void);
+
+// Called from interrupts that leave work for the main loop
+void idleWake(void);
+
+void idleStatistics(IdleStatistics *stats, uint8_t reset);
+
+#endif // __IDLE_H__
+
@@ -7,16 +7,18 @@
  *
  * Each command consists of one character identifying the action to be
  * executed, prefixed by an arbitrary string set in this module, followed by
- * an optional unnamed parameter and, if the unnamed parameter exists, more
- * optional named parameters. The command ends with a new-line (\n).
- * Only ASCII decimal numbers are supported as parameters.
+ * an optional unnamed parameter and more optional named parameters, each a
+ * case sensitive letter followed by a number.
+ * The command ends with a new-line (\n).
+ * Only ASCII decimal numbers up to 32bit are supported as parameters.
  *
  * For example, if the prefix is set to "$$":
  *     $$v\n - Show the version information
  *     $$p10d500\n - Run pump 10 for a duration of 500ms
+ *     $$e10P3W4\n - Power budget of 10, pump 3 draws 4 of it
  *
  * The implementation of the methods is done in this module, too.
- * They are then included in the commands[] list.
+ * They are then included in the INTERFACE_COMMANDS list.
  *
  * Copyright (c) 2017 Thomas Buck <xythobuz@xythobuz.de>
  * All rights reserved.
@@ -25,7 +27,23 @@
 #ifndef __INTERFACE_H__
 #define __INTERFACE_H__
 
-void interfaceHandler(uint8_t c, uint16_t arg);
+#define INTERFACE_MAX_NAMED 5
+
+#define INTERFACE_GIVEN_VALUE (1 << 0)
+#define INTERFACE_GIVEN_NAMED(n) (1 << ((n) + 1))
+
+typedef struct {
+    uint32_t value; // unnamed parameter, 0 if not given
+    uint32_t named[INTERFACE_MAX_NAMED]; // in the order listed for the command
+    uint8_t given; // INTERFACE_GIVEN_ flags
+} InterfaceArgs;
+
+// execute command c, args may be NULL, returns one of the STATUS_ codes
+uint8_t interfaceHandler(uint8_t c, const InterfaceArgs *args);
+
+// print a human-readable message for one of the STATUS_ codes
+void interfacePrintStatus(uint8_t status);
+
 void interfaceLoop(void);
 
 #endif // __INTERFACE_H__
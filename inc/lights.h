@@ -40,10 +40,21 @@ void lightsInit(void);
 // id: (1 - 20), state: (0 or 1)
 void lightsSet(uint8_t id, uint8_t state);
 
+// bit (n - 1) for light n, one write per port
+void lightsSetMask(uint32_t on, uint32_t off);
+
 void lightsRGB(uint16_t led, uint32_t color);
+
+// the strip is refreshed by TASK_LIGHTS, as soon as the DMA is available
 void lightsDisplayBuffer(void);
+void lightsTask(void);
+
+uint8_t lightsBusy(void);
 
-#define lightsBusy() (DMA.STATUS & (DMA_CH0BUSY_bm | DMA_CH1BUSY_bm))
+// DMA channel 0 can be lent to the pump module while the strip is idle.
+// Returns 0 if a transfer is running or the channel has already been lent.
+uint8_t lightsLendDMA(void);
+void lightsReturnDMA(void);
 
 #endif // __LIGHTS_H__
 
@@ -0,0 +1,43 @@
+/*
+ * protocol.h
+ * avr_pump_board
+ *
+ * Binary host protocol, see protocol.c
+ *
+ * Copyright (c) 2017 Thomas Buck <xythobuz@xythobuz.de>
+ * All rights reserved.
+ */
+
+#ifndef __PROTOCOL_H__
+#define __PROTOCOL_H__
+
+// decoded frame size limit, including opcode and CRC
+#define PROTOCOL_MAX_FRAME 192
+
+#define PROTOCOL_OP_VERSION 0x01
+#define PROTOCOL_OP_RECIPE 0x02
+#define PROTOCOL_OP_GO 0x03
+#define PROTOCOL_OP_LIST 0x04
+#define PROTOCOL_OP_PUMP_ON 0x05
+#define PROTOCOL_OP_PUMP_OFF 0x06
+#define PROTOCOL_OP_CLEAN 0x07
+#define PROTOCOL_OP_ASCII 0x08
+#define PROTOCOL_OP_STATUS 0x09
+#define PROTOCOL_OP_ABORT 0x0A
+#define PROTOCOL_OP_BUDGET 0x0B
+#define PROTOCOL_OP_SLOT 0x0C
+
+#define PROTOCOL_REPLY 0x80
+#define PROTOCOL_EVENT 0xFE
+#define PROTOCOL_NAK 0xFF
+
+#define PROTOCOL_EVENT_DONE 0x01
+
+void protocolStart(void);
+// slot 0 is not sent, for hosts that only use one slot
+void protocolEvent(uint8_t event, uint8_t slot);
+uint8_t protocolActive(void);
+void protocolLoop(void);
+
+#endif // __PROTOCOL_H__
+
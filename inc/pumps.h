@@ -22,14 +22,95 @@
 
 #include "recipe.h"
 
+// all functions returning uint8_t, except pumpsDispensing, return STATUS_ codes
+
 void pumpsInit(void);
-void pumpsClean(uint8_t state);
 
-void pumpsRecipe(RecipeIngredient *recipe, uint8_t ingredients);
+// TASK_PUMPS, runs after a recipe has been dispensed
+void pumpsTask(void);
+
+// TASK_CLEAN, one step of the cleaning sequence
+void pumpsCleanTask(void);
+
+typedef struct {
+    uint32_t mask; // pumps to clean, bit (n - 1) for pump n
+    uint32_t onTime; // ms each pump runs per cycle, 0: until stopped
+    uint32_t pause; // ms between the last pump of a cycle and the next cycle
+    uint16_t stagger; // ms between switching two pumps
+    uint16_t cycles; // flush cycles, ignored when running until stopped
+} PumpCleanConfig;
+
+#define PUMP_CLEAN_DEFAULTS { PUMPS_ALL_MASK, 0, 0, PUMP_CLEAN_DELAY, 1 }
+
+typedef struct {
+    uint16_t cycle; // 1 to cycles
+    uint16_t cycles;
+    uint8_t pumps; // in the sequence
+    uint8_t done; // turned off again in this cycle
+    uint8_t stopping;
+} PumpCleanProgress;
+
+// Runs in the background, pumps are switched one after another. Stopping
+// turns off the running pumps the same way, pumpsDispensing() stays set
+// until the last pump has been turned off.
+uint8_t pumpsCleanStart(const PumpCleanConfig *config);
+uint8_t pumpsCleanStop(void);
+
+// state 1: start with PUMP_CLEAN_DEFAULTS, state 0: stop
+uint8_t pumpsClean(uint8_t state);
+
+// returns 0 if no cleaning sequence is running
+uint8_t pumpsCleanProgress(PumpCleanProgress *progress);
+
+// the recipe is copied, it can be changed while dispensing. align is one of
+// the RECIPE_ALIGN_ modes. ingredients may start after their aligned delay
+// to stay within the power budget, which is shared with the other slots.
+// Each pump may only be used once. Recipes in other slots can be running,
+// but none of them may use the same pumps (STATUS_PUMPS_OVERLAP).
+uint8_t pumpsRecipe(uint8_t slot, const RecipeIngredient *recipe, uint8_t ingredients,
+        uint8_t align);
+
+// bit n is set while the recipe in slot n is dispensed
+uint8_t pumpsSlots(void);
+
+// Power budget: pump n draws weight[n - 1] while running, the pumps of a
+// recipes never draw more than budget at once. No weight may exceed the
+// budget. With all weights 1, the budget limits the pumps running at once.
+// weight may be NULL to keep the current weights.
+uint8_t pumpsSetBudget(uint16_t budget, const uint8_t *weight);
+uint16_t pumpsBudget(void);
+uint8_t pumpsWeight(uint8_t pump);
 uint8_t pumpsDispensing(void);
 
-void pumpOn(uint16_t arg);
-void pumpOff(uint16_t arg);
+// all slots and cleaning, or only the recipe in one slot
+uint8_t pumpsAbort(void);
+uint8_t pumpsAbortSlot(uint8_t slot);
+
+// returns one of these once after a recipe or cleaning sequence has ended,
+// slot receives the slot of the recipe. call again until NONE is returned,
+// more than one may have ended.
+#define PUMPS_FINISHED_NONE 0
+#define PUMPS_FINISHED_RECIPE 1
+#define PUMPS_FINISHED_CLEAN 2
+uint8_t pumpsFinished(uint8_t *slot);
+
+// pumps that are turned on
+uint32_t pumpsRunningMask(void);
+
+// milliseconds until pump n is turned off by a running recipe or cleaning
+// cycle, or 0. this includes the delay of pumps that have not been started yet.
+uint32_t pumpsRemaining(uint8_t pump);
+
+// Pump sets: bit (n - 1) for pump n
+#define PUMP_MASK(n) (1ul << ((n) - 1))
+#define PUMPS_ALL_MASK 0x000FFFFFul
+
+// Turn off the pumps in off, then turn on the pumps in on. Each port is
+// written once, so all pumps on a port switch at the same time.
+uint8_t pumpsSwitch(uint32_t on, uint32_t off);
+
+uint8_t pumpOn(uint32_t id);
+uint8_t pumpOff(uint32_t id);
 
 #endif // __PUMPS_H__
 
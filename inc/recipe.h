@@ -6,6 +6,10 @@
  * To ensure the amount of liquids dispensed is accurate, we first transmit
  * all the required pumps and their durations before starting them all at once.
  *
+ * There are RECIPE_SLOTS independent recipes, one for each nozzle. All
+ * commands work on the selected slot, the slots can be dispensed at the
+ * same time when they use different pumps.
+ *
  * Copyright (c) 2017 Thomas Buck <xythobuz@xythobuz.de>
  * All rights reserved.
  */
@@ -15,17 +19,31 @@
 
 typedef struct {
     uint8_t pump;
-    uint16_t time;
-    uint16_t delay;
+    uint32_t time;
+    uint32_t delay;
 } RecipeIngredient;
 
-void recipeReset(uint16_t arg);
-void recipePump(uint16_t arg);
-void recipeDuration(uint16_t arg);
-void recipeDelay(uint16_t arg);
-void recipeStore(uint16_t arg);
-void recipeGo(uint16_t arg);
-void recipeList(uint16_t arg);
+// Alignment of the ingredients of a recipe, the delays are added to it
+#define RECIPE_ALIGN_START 0 // all start together
+#define RECIPE_ALIGN_END 1 // all end together
+#define RECIPE_ALIGN_CENTER 2 // centered on the longest one
+
+// command handlers, returning one of the STATUS_ codes
+uint8_t recipeReset(void);
+uint8_t recipePump(uint32_t pump);
+uint8_t recipeDuration(uint32_t time);
+uint8_t recipeDelay(uint32_t delay);
+uint8_t recipeAlign(uint32_t align);
+uint8_t recipeSelect(uint32_t slot);
+uint8_t recipeStore(void);
+uint8_t recipeGo(void);
+uint8_t recipeList(void);
+
+// access to the stored ingredients of the selected slot, i: (0 - recipeCount() - 1)
+uint8_t recipeSelected(void);
+uint8_t recipeCount(void);
+uint8_t recipeAlignment(void);
+const RecipeIngredient *recipeIngredient(uint8_t i);
 
 #endif // __RECIPE_H__
 
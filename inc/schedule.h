@@ -0,0 +1,43 @@
+/*
+ * schedule.h
+ * avr_pump_board
+ *
+ * Start times for the ingredients of a recipe, so the pumps running at
+ * once never draw more than the power budget. Plain C without AVR
+ * dependencies, so it can be built on the host.
+ *
+ * Copyright (c) 2017 Thomas Buck <xythobuz@xythobuz.de>
+ * All rights reserved.
+ */
+
+#ifndef __SCHEDULE_H__
+#define __SCHEDULE_H__
+
+#include <stdint.h>
+
+#include "recipe.h"
+
+// Power drawn by pumps that are already running, level from time on until
+// the time of the next entry. It is 0 before the first entry and stays at
+// the level of the last one.
+typedef struct {
+    uint32_t time;
+    uint16_t level;
+} ScheduleLoad;
+
+/*
+ * Pump n draws weight[n - 1] while running, at most budget at once.
+ * align is one of the RECIPE_ALIGN_ modes, the delay of each ingredient
+ * is added to its aligned start, and no ingredient starts before that.
+ * The loads entries in load, sorted by time, count against the budget too.
+ * start[i] receives the start time of ingredient i, chosen greedily to
+ * finish the recipe early. Returns the time the last pump turns off, or
+ * 0 if an ingredient can never run within the budget or the schedule
+ * exceeds 32 bits.
+ */
+uint32_t scheduleRecipe(const RecipeIngredient *recipe, uint8_t count, uint8_t align,
+        const uint8_t *weight, uint16_t budget, const ScheduleLoad *load, uint8_t loads,
+        uint32_t *start);
+
+#endif // __SCHEDULE_H__
+
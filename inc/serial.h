@@ -44,6 +44,17 @@
 /** Calculate Baudrate Register Value */
 #define BAUD(baudRate,xtalCpu) ((xtalCpu) / ((baudRate) * 16l) - 1)
 
+#define SERIAL_BAUD_MAX_ERROR 200 /**< Maximum baudrate error in 0.01% */
+
+/** XMega Fractional Baudrate Generator settings */
+typedef struct {
+    uint16_t bsel; /**< 12bit baudrate selection value */
+    int8_t bscale; /**< Baudrate scale factor, -7 to 7 */
+    uint8_t clk2x; /**< 1 for double speed mode */
+    uint32_t rate; /**< Resulting baudrate */
+    int16_t error; /**< Relative error of resulting baudrate, in 0.01% */
+} SerialBaud;
+
 /** Get number of available UART modules.
  *  \returns number of modules
  */
@@ -55,6 +66,29 @@ uint8_t serialAvailable(void);
  */
 void serialInit(uint8_t uart, uint16_t baud);
 
+/** Find the best baudrate generator settings for a baudrate.
+ *  All BSCALE and CLK2X combinations are tried, for the current F_CPU.
+ *  XMega only!
+ *  \param rate Desired baudrate
+ *  \param baud Best settings, with resulting rate and error
+ *  \returns 0 on success, 1 if the error is larger than SERIAL_BAUD_MAX_ERROR
+ */
+uint8_t serialBaudCalculate(uint32_t rate, SerialBaud *baud);
+
+/** Change the baudrate of an initialized UART.
+ *  Use serialFlush() before, so no byte is sent with mixed timing.
+ *  XMega only!
+ *  \param uart UART Module to change
+ *  \param baud Settings from serialBaudCalculate()
+ */
+void serialSetBaud(uint8_t uart, const SerialBaud *baud);
+
+/** Wait until all buffered bytes have been sent.
+ *  Interrupts have to be enabled!
+ *  \param uart UART Module to wait for
+ */
+void serialFlush(uint8_t uart);
+
 /** Stop the UART Hardware.
  *  \param uart UART Module to stop
  */
@@ -97,6 +131,13 @@ uint8_t serialRxBufferFull(uint8_t uart);
  */
 uint8_t serialRxBufferEmpty(uint8_t uart);
 
+/** Get the number of received bytes that have been lost.
+ *  Bytes are lost when they arrive while the receive buffer is full.
+ *  \param uart UART Module to check
+ *  \returns number of lost bytes, saturating at 65535
+ */
+uint16_t serialRxOverruns(uint8_t uart);
+
 /** Send a byte.
  *  \param uart UART Module to write to
  *  \param data Byte to send
@@ -109,12 +150,41 @@ void serialWrite(uint8_t uart, uint8_t data);
  */
 void serialWriteString(uint8_t uart, const char *data);
 
+/** Send a buffer.
+ *  The buffer is copied into the TX buffer in as few chunks as possible,
+ *  and the transmission is started only once.
+ *  \param uart UART Module to write to
+ *  \param data Bytes to send
+ *  \param len Number of bytes to send
+ */
+void serialWriteBuffer(uint8_t uart, const uint8_t *data, uint16_t len);
+
+/** Send a buffer of binary data.
+ *  Like serialWriteBuffer(), but no CR is ever injected.
+ *  \param uart UART Module to write to
+ *  \param data Bytes to send
+ *  \param len Number of bytes to send
+ */
+void serialWriteRaw(uint8_t uart, const uint8_t *data, uint16_t len);
+
+/** Send a string literal, with its length known at compile-time.
+ *  \param uart UART Module to write to
+ *  \param s String literal (not a pointer!)
+ */
+#define serialWriteLiteral(uart, s) serialWriteBuffer(uart, (const uint8_t *)(s), sizeof(s) - 1)
+
 /** Send a 16bit integer.
  *  \param uart UART Module to write to
  *  \param num Unsigned integer to send as decimal ASCII
  */
 void serialWriteInt16(uint8_t uart, uint16_t num);
 
+/** Send a 32bit integer.
+ *  \param uart UART Module to write to
+ *  \param num Unsigned integer to send as decimal ASCII
+ */
+void serialWriteInt32(uint8_t uart, uint32_t num);
+
 /** Check if the transmit buffer is full.
  *  \param uart UART Module to check
  *  \returns 1 if buffer is full, 0 if not
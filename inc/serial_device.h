@@ -284,6 +284,37 @@ volatile USART_t * const serialRegisters[UART_COUNT] = {
     &USARTF1 */
 };
 
+// DMA trigger sources for the "data register empty" events
+uint8_t const serialDmaTxTriggers[UART_COUNT] = {
+    DMA_CH_TRIGSRC_USARTC0_DRE_gc,
+    DMA_CH_TRIGSRC_USARTC1_DRE_gc /*,
+    DMA_CH_TRIGSRC_USARTD0_DRE_gc,
+    DMA_CH_TRIGSRC_USARTD1_DRE_gc,
+    DMA_CH_TRIGSRC_USARTE0_DRE_gc,
+    DMA_CH_TRIGSRC_USARTE1_DRE_gc,
+    DMA_CH_TRIGSRC_USARTF0_DRE_gc,
+    DMA_CH_TRIGSRC_USARTF1_DRE_gc */
+};
+
+// DMA trigger sources for the "receive complete" events
+uint8_t const serialDmaRxTriggers[UART_COUNT] = {
+    DMA_CH_TRIGSRC_USARTC0_RXC_gc,
+    DMA_CH_TRIGSRC_USARTC1_RXC_gc /*,
+    DMA_CH_TRIGSRC_USARTD0_RXC_gc,
+    DMA_CH_TRIGSRC_USARTD1_RXC_gc,
+    DMA_CH_TRIGSRC_USARTE0_RXC_gc,
+    DMA_CH_TRIGSRC_USARTE1_RXC_gc,
+    DMA_CH_TRIGSRC_USARTF0_RXC_gc,
+    DMA_CH_TRIGSRC_USARTF1_RXC_gc */
+};
+
+// DMA channels reserved for draining a transmit buffer and filling a receive
+// buffer (channels 0 and 1 are used by the WS2812 driver in lights.c)
+#define SERIALDMATXCHANNEL DMA.CH2
+#define SERIALDMATXINTERRUPT DMA_CH2_vect
+#define SERIALDMARXCHANNEL DMA.CH3
+#define SERIALDMARXINTERRUPT DMA_CH3_vect
+
 #define SERIALRECIEVEINTERRUPT   USARTC0_RXC_vect
 #define SERIALTRANSMITINTERRUPT  USARTC0_TXC_vect
 #define SERIALRECIEVEINTERRUPT1   USARTC1_RXC_vect
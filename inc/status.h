@@ -0,0 +1,35 @@
+/*
+ * status.h
+ * avr_pump_board
+ *
+ * Result codes returned by the command handlers in the interface, recipe
+ * and pump modules. The ASCII interface prints a message for each of them,
+ * the binary protocol sends the code itself.
+ *
+ * Copyright (c) 2017 Thomas Buck <xythobuz@xythobuz.de>
+ * All rights reserved.
+ */
+
+#ifndef __STATUS_H__
+#define __STATUS_H__
+
+#define STATUS_OK 0
+#define STATUS_UNKNOWN_COMMAND 1
+#define STATUS_INVALID_PREFIX 2
+#define STATUS_INVALID_PARAMETER 3
+#define STATUS_PARAMETER_TOO_LONG 4
+#define STATUS_LINE_TOO_LONG 5
+#define STATUS_INVALID_PUMP 6
+#define STATUS_INVALID_TIME 7
+#define STATUS_TOO_MANY_INGREDIENTS 8
+#define STATUS_INCOMPLETE_INGREDIENT 9
+#define STATUS_NO_INGREDIENTS 10
+#define STATUS_PUMPS_RUNNING 11
+#define STATUS_PUMPS_IDLE 12
+#define STATUS_INVALID_BAUDRATE 13
+#define STATUS_INVALID_FRAME 14
+#define STATUS_CRC_ERROR 15
+#define STATUS_PUMPS_OVERLAP 16
+
+#endif // __STATUS_H__
+
@@ -0,0 +1,51 @@
+/*
+ * task.h
+ * avr_pump_board
+ *
+ * Cooperative scheduler for the work done outside of interrupts.
+ * Tasks run to completion, so they must never wait for anything.
+ * Instead, interrupts mark a task as ready and it runs from the main loop.
+ *
+ * Copyright (c) 2017 Thomas Buck <xythobuz@xythobuz.de>
+ * All rights reserved.
+ */
+
+#ifndef __TASK_H__
+#define __TASK_H__
+
+typedef void (*TaskFunction)(void);
+
+// ready tasks run in this order
+enum {
+    TASK_INTERFACE = 0,
+    TASK_PUMPS,
+    TASK_CLEAN,
+    TASK_LIGHTS,
+    TASK_HEARTBEAT,
+
+    TASK_COUNT
+};
+
+typedef struct {
+    const char *name;
+    uint32_t runs;
+    uint64_t cycles; // CPU cycles spent in the task
+    uint32_t maxCycles; // longest single run
+} TaskStatistics;
+
+void taskRegister(uint8_t id, const char *name, TaskFunction function);
+
+// may be called from interrupts, the task runs once on the next pass
+void taskReady(uint8_t id);
+
+// run every period ms, starting period ms from now. 0: only when ready.
+void taskSchedule(uint8_t id, uint32_t period);
+
+// one pass over all ready tasks, each runs at most once
+void taskLoop(void);
+
+// fills stats for all TASK_COUNT tasks, returns the cycles since the last reset
+uint64_t taskStatistics(TaskStatistics *stats, uint8_t reset);
+
+#endif // __TASK_H__
+
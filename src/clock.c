@@ -2,7 +2,18 @@
  * clock.c
  * avr_pump_board
  *
- * Runs a system-timer with 1ms resolution on Timer1.
+ * The system time is a free-running 32-bit counter at 4MHz, built from
+ * TimerC0 (low word) and TimerC1 (high word), cascaded through event
+ * channel 2. Only the overflow of TimerC1, every 17.9 minutes, needs an
+ * interrupt to extend it to 64 bits.
+ *
+ * TIMER_SLOTS software timers are kept in a binary heap. Only the earliest
+ * deadline is armed, with a compare on the high word until the low word
+ * can be compared directly, so there is no periodic tick interrupt.
+ *
+ * A one-shot with 0.25us resolution runs on TimerE0. The timer counts
+ * freely at 4MHz, its overflows extend the count to 48 bits. The compare
+ * interrupt is only armed after the last overflow before the deadline.
  *
  * Copyright (c) 2017 Thomas Buck <xythobuz@xythobuz.de>
  * All rights reserved.
@@ -21,6 +32,7 @@
 #endif // DEBUG_CLOCK
 
 #include "clock.h"
+#include "idle.h"
 
 void initOSCs(void) {
     // Setup system clock source
@@ -45,53 +57,446 @@ void initOSCs(void) {
 
 // ----------------------------------------------------------------------------
 
-volatile static uint64_t systemTime = 0;
+#define CLOCK_TICKS_PER_US (F_CPU / 8000000ul)
+#define CLOCK_TICKS_PER_MS (CLOCK_TICKS_PER_US * 1000ul)
+#define CLOCK_CYCLES_PER_TICK 8
+
+// overdue deadlines are armed this far in the future, 8us
+#define TIMER_ARM_MARGIN (8 * CLOCK_TICKS_PER_US)
+
+volatile static uint32_t clockEpoch = 0; // TimerC1 overflows
+
+// Timer ids hold the slot and a generation, so a stale id can't cancel
+// the timer that reuses its slot.
+#define TIMER_SLOT_BITS 3
+#define TIMER_SLOT_MASK ((1 << TIMER_SLOT_BITS) - 1)
+#define TIMER_GENERATION_MASK 0x0F
+#define TIMER_NOT_QUEUED 0xFF
+
+typedef struct {
+    uint64_t deadline;
+    TimerCallback callback; // NULL if the slot is free
+    uint8_t flags;
+    uint8_t generation;
+    uint8_t position; // index in timerHeap or TIMER_NOT_QUEUED
+} TimerSlot;
+
+static TimerSlot timers[TIMER_SLOTS];
+
+// min-heap of queued slots, ordered by deadline
+static uint8_t timerHeap[TIMER_SLOTS];
+static uint8_t timerCount = 0;
 
-typedef void (*CallbackType)(void);
+// deferred timers that have expired, bit n for slot n
+volatile static uint8_t timerPending = 0;
 
-volatile static uint64_t quickTimeFire = 0;
-volatile static CallbackType quickTimeCallback = NULL;
+// deadline of the running callback, timers started from it count from there
+static uint64_t timerBase = 0;
+static uint8_t timerFiring = 0;
 
 void initSystemTimer(void) {
-    // initialize TimerC0 with 32MHz / 64 / 500 = 1kHz
-    TCC0.CTRLA = TC0_CLKSEL0_bm | TC0_CLKSEL2_bm; // Prescaler 64
-    TCC0.PER = 500; // overflow when counting to 500
-    TCC0.INTCTRLB = 0x03; // high interrupt level
+    for (uint8_t i = 0; i < TIMER_SLOTS; i++) {
+        timers[i].callback = NULL;
+        timers[i].position = TIMER_NOT_QUEUED;
+    }
+
+    TCC0.CTRLA = TC_CLKSEL_OFF_gc;
+    TCC1.CTRLA = TC_CLKSEL_OFF_gc;
+
+    // TimerC0 overflows clock TimerC1
+    EVSYS.CH2MUX = EVSYS_CHMUX_TCC0_OVF_gc;
+    EVSYS.CH2CTRL = 0x00;
+
+    TCC1.CTRLB = TC_WGMODE_NORMAL_gc;
+    TCC1.PER = 0xFFFF;
+    TCC1.CNT = 0;
+    TCC1.INTFLAGS = TC1_OVFIF_bm | TC1_CCAIF_bm;
+    TCC1.INTCTRLA = TC_OVFINTLVL_HI_gc;
+    TCC1.INTCTRLB = TC_CCAINTLVL_OFF_gc;
+    TCC1.CTRLA = TC_CLKSEL_EVCH2_gc;
+
+    // initialize TimerC0 with 32MHz / 8 = 4MHz
+    TCC0.CTRLB = TC_WGMODE_NORMAL_gc;
+    TCC0.PER = 0xFFFF;
+    TCC0.CNT = 0;
+    TCC0.INTFLAGS = TC0_OVFIF_bm | TC0_CCAIF_bm;
+    TCC0.INTCTRLB = TC_CCAINTLVL_OFF_gc;
+    TCC0.CTRLA = TC_CLKSEL_DIV8_gc;
+}
+
+ISR(TCC1_OVF_vect) {
+    clockEpoch++;
+}
+
+// must be called with interrupts disabled
+static uint64_t clockTicks(void) {
+    // the high word may only change while reading the low word
+    uint16_t high, low;
+    do {
+        high = TCC1.CNT;
+        low = TCC0.CNT;
+    } while (high != TCC1.CNT);
+
+    // overflow interrupt is still pending
+    uint32_t epoch = clockEpoch;
+    if ((TCC1.INTFLAGS & TC1_OVFIF_bm) && (high < 0x8000)) {
+        epoch++;
+    }
+
+    return ((uint64_t)epoch << 32) | ((uint32_t)high << 16) | low;
 }
 
 uint64_t getSystemTime(void) {
-    return systemTime;
+    uint8_t sreg = SREG;
+    cli();
+    uint64_t ticks = clockTicks();
+    SREG = sreg;
+    return ticks / CLOCK_TICKS_PER_MS;
 }
 
-ISR(TCC0_CCA_vect) {
-    systemTime++;
+uint32_t getSystemMicros(void) {
+    uint8_t sreg = SREG;
+    cli();
+    uint64_t ticks = clockTicks();
+    SREG = sreg;
+    return ticks / CLOCK_TICKS_PER_US;
+}
+
+uint32_t getSystemCycles(void) {
+    uint8_t sreg = SREG;
+    cli();
+    uint64_t ticks = clockTicks();
+    SREG = sreg;
+    return ticks * CLOCK_CYCLES_PER_TICK;
+}
+
+// ----------------------------------------------------------------------------
+
+static void timerSwap(uint8_t a, uint8_t b) {
+    uint8_t slot = timerHeap[a];
+    timerHeap[a] = timerHeap[b];
+    timerHeap[b] = slot;
+    timers[timerHeap[a]].position = a;
+    timers[timerHeap[b]].position = b;
+}
+
+static uint8_t timerEarlier(uint8_t a, uint8_t b) {
+    return timers[timerHeap[a]].deadline < timers[timerHeap[b]].deadline;
+}
+
+static void timerSiftUp(uint8_t pos) {
+    while ((pos > 0) && timerEarlier(pos, (pos - 1) / 2)) {
+        timerSwap(pos, (pos - 1) / 2);
+        pos = (pos - 1) / 2;
+    }
+}
 
-    if (quickTimeCallback != NULL) {
-        if (systemTime == quickTimeFire) {
-            quickTimeCallback();
+static void timerSiftDown(uint8_t pos) {
+    for (;;) {
+        uint8_t child = (2 * pos) + 1;
+        if (child >= timerCount) {
+            break;
+        }
+        if (((child + 1) < timerCount) && timerEarlier(child + 1, child)) {
+            child++;
+        }
+        if (!timerEarlier(child, pos)) {
+            break;
         }
+        timerSwap(pos, child);
+        pos = child;
     }
 }
 
-// ----------------------------------------------------------------------------
+static void timerRemove(uint8_t slot) {
+    uint8_t pos = timers[slot].position;
+    timerCount--;
+    if (pos != timerCount) {
+        timerSwap(pos, timerCount);
+        timerSiftUp(pos);
+        timerSiftDown(timers[timerHeap[pos]].position);
+    }
+    timers[slot].position = TIMER_NOT_QUEUED;
+}
 
-void quickTimeInit(void) {
-    // TODO wanted to use RTC32, but our MCU doesn't have this peripheral! :(
+static void timerFree(uint8_t slot) {
+    timers[slot].callback = NULL;
+    timers[slot].generation = (timers[slot].generation + 1) & TIMER_GENERATION_MASK;
+    timerPending &= ~(1 << slot);
 }
 
-void quickTimeFireIn(uint16_t millis, void (*callback)(void)) {
+// Arms the compare for the earliest deadline, with interrupts disabled
+static void timerArm(void) {
+    TCC0.INTCTRLB = TC_CCAINTLVL_OFF_gc;
+    TCC1.INTCTRLB = TC_CCAINTLVL_OFF_gc;
+
+    if (timerCount == 0) {
+        return;
+    }
+
+    for (;;) {
+        uint64_t now = clockTicks();
+        uint64_t deadline = timers[timerHeap[0]].deadline;
+        if (deadline <= now) {
+            deadline = now + TIMER_ARM_MARGIN;
+        }
+
+        if ((deadline >> 16) == (now >> 16)) {
+            TCC0.INTFLAGS = TC0_CCAIF_bm;
+            TCC0.CCA = deadline & 0xFFFF;
+            TCC0.INTCTRLB = TC_CCAINTLVL_HI_gc;
+            if ((TCC0.INTFLAGS & TC0_CCAIF_bm) || (clockTicks() < deadline)) {
+                return;
+            }
+        } else {
+            // matches once per epoch until the right one has been reached
+            TCC1.INTFLAGS = TC1_CCAIF_bm;
+            TCC1.CCA = (deadline >> 16) & 0xFFFF;
+            TCC1.INTCTRLB = TC_CCAINTLVL_HI_gc;
+            if ((TCC1.INTFLAGS & TC1_CCAIF_bm) || ((clockTicks() >> 16) < (deadline >> 16))) {
+                return;
+            }
+        }
+
+        // compare value has been passed while arming
+        TCC0.INTCTRLB = TC_CCAINTLVL_OFF_gc;
+        TCC1.INTCTRLB = TC_CCAINTLVL_OFF_gc;
+    }
+}
+
+// must be called with interrupts disabled, returns with the previous state.
+// deferred callbacks run with interrupts enabled, so an ISR may start a
+// timer meanwhile. only callbacks in the ISR let timers count from their
+// deadline, deferred ones clear the firing state before interrupts are on.
+static void timerRun(uint8_t slot, uint8_t sreg) {
+    TimerCallback callback = timers[slot].callback;
+    uint64_t base = timerBase;
+    uint8_t firing = timerFiring;
+
+    timerBase = timers[slot].deadline;
+    timerFiring = !(timers[slot].flags & TIMER_DEFERRED);
+    timerFree(slot);
+
+    SREG = sreg;
+    callback();
+    cli();
+
+    timerBase = base;
+    timerFiring = firing;
+}
+
+ISR(TCC0_CCA_vect) {
+    uint64_t now = clockTicks();
+
+    while ((timerCount > 0) && (timers[timerHeap[0]].deadline <= now)) {
+        uint8_t slot = timerHeap[0];
+        timerRemove(slot);
+
+        if (timers[slot].flags & TIMER_DEFERRED) {
+            timerPending |= 1 << slot;
+            idleWake();
+        } else {
+            timerRun(slot, SREG);
+        }
+    }
+
+    timerArm();
+}
+
+ISR(TCC1_CCA_vect) {
+    timerArm();
+}
+
+uint8_t timerStart(uint32_t millis, TimerCallback callback, uint8_t flags) {
+    uint8_t sreg = SREG;
+    cli();
+
+    uint8_t slot = 0;
+    while ((slot < TIMER_SLOTS) && (timers[slot].callback != NULL)) {
+        slot++;
+    }
+    if (slot >= TIMER_SLOTS) {
+        SREG = sreg;
+        return TIMER_INVALID;
+    }
+
+    uint64_t ticks = (uint64_t)millis * CLOCK_TICKS_PER_MS;
+    timers[slot].deadline = (timerFiring ? timerBase : clockTicks()) + ticks;
+    timers[slot].callback = callback;
+    timers[slot].flags = flags;
+
+    timerHeap[timerCount] = slot;
+    timers[slot].position = timerCount;
+    timerCount++;
+    timerSiftUp(timers[slot].position);
+    timerArm();
+
+    uint8_t id = (timers[slot].generation << TIMER_SLOT_BITS) | slot;
+    SREG = sreg;
+
 #ifdef DEBUG_CLOCK
-    serialWriteString(1, "Debug: fire in ");
-    serialWriteInt16(1, millis);
-    serialWriteString(1, " at ");
-    serialWriteInt16(1, systemTime + millis);
-    serialWriteString(1, " now ");
-    serialWriteInt16(1, systemTime);
-    serialWriteString(1, "\n");
+    serialWriteLiteral(1, "Debug: timer ");
+    serialWriteInt16(1, id);
+    serialWriteLiteral(1, " fires in ");
+    serialWriteInt32(1, millis);
+    serialWriteLiteral(1, "\n");
 #endif // DEBUG_CLOCK
 
-    // called again from ISR!
-    quickTimeFire = systemTime + millis;
-    quickTimeCallback = callback;
+    return id;
+}
+
+void timerCancel(uint8_t id) {
+    if (id == TIMER_INVALID) {
+        return;
+    }
+
+    uint8_t slot = id & TIMER_SLOT_MASK;
+
+    uint8_t sreg = SREG;
+    cli();
+    if ((timers[slot].callback != NULL)
+            && (timers[slot].generation == (id >> TIMER_SLOT_BITS))) {
+        if (timers[slot].position != TIMER_NOT_QUEUED) {
+            timerRemove(slot);
+        }
+        timerFree(slot);
+        timerArm();
+    }
+    SREG = sreg;
+}
+
+void timerLoop(void) {
+    uint8_t sreg = SREG;
+    cli();
+
+    // run the expired deferred timers in deadline order
+    while (timerPending) {
+        uint8_t next = TIMER_SLOTS;
+        for (uint8_t i = 0; i < TIMER_SLOTS; i++) {
+            if ((timerPending & (1 << i)) && ((next >= TIMER_SLOTS)
+                    || (timers[i].deadline < timers[next].deadline))) {
+                next = i;
+            }
+        }
+        timerRun(next, sreg);
+    }
+
+    SREG = sreg;
+}
+
+// ----------------------------------------------------------------------------
+
+#define PRECISE_TICKS_PER_US (F_CPU / 8000000ul)
+
+volatile static uint32_t preciseOverflows = 0;
+volatile static uint64_t preciseDeadline = 0;
+volatile static TimerCallback preciseCallback = NULL;
+volatile static uint8_t preciseFiring = 0;
+
+void preciseTimeInit(void) {
+    // initialize TimerE0 with 32MHz / 8 = 4MHz, counting to 0xFFFF
+    TCE0.CTRLA = TC_CLKSEL_OFF_gc;
+    TCE0.CTRLB = TC_WGMODE_NORMAL_gc;
+    TCE0.PER = 0xFFFF;
+    TCE0.CNT = 0;
+    TCE0.INTFLAGS = TC0_OVFIF_bm | TC0_CCAIF_bm;
+    TCE0.INTCTRLA = TC_OVFINTLVL_OFF_gc;
+    TCE0.INTCTRLB = TC_CCAINTLVL_OFF_gc;
+    TCE0.CTRLA = TC_CLKSEL_DIV8_gc;
+
+    preciseOverflows = 0;
+    preciseCallback = NULL;
+}
+
+// must be called with interrupts disabled
+static uint64_t preciseNow(void) {
+    uint16_t count = TCE0.CNT;
+    uint32_t overflows = preciseOverflows;
+
+    // overflow interrupt is still pending
+    if ((TCE0.INTFLAGS & TC0_OVFIF_bm) && (count < 0x8000)) {
+        overflows++;
+    }
+
+    return ((uint64_t)overflows << 16) | count;
+}
+
+static void preciseFire(void) {
+    TCE0.INTCTRLB = TC_CCAINTLVL_OFF_gc;
+
+    TimerCallback callback = preciseCallback;
+    preciseCallback = NULL;
+
+    // the callback may schedule the next deadline relative to this one
+    preciseFiring = 1;
+    callback();
+    preciseFiring = 0;
+
+    // don't wake up every 16ms while nothing is scheduled
+    if (preciseCallback == NULL) {
+        TCE0.INTCTRLA = TC_OVFINTLVL_OFF_gc;
+    }
+}
+
+static void preciseArm(void) {
+    if ((uint32_t)(preciseDeadline >> 16) != preciseOverflows) {
+        return; // armed by the overflow interrupt later on
+    }
+
+    uint16_t low = preciseDeadline & 0xFFFF;
+    TCE0.CCA = low;
+    TCE0.INTFLAGS = TC0_CCAIF_bm;
+    TCE0.INTCTRLB = TC_CCAINTLVL_HI_gc;
+
+    // compare value has already been passed while arming
+    if ((TCE0.CNT >= low) && !(TCE0.INTFLAGS & TC0_CCAIF_bm)) {
+        preciseFire();
+    }
+}
+
+ISR(TCE0_OVF_vect) {
+    preciseOverflows++;
+
+    if (preciseCallback != NULL) {
+        preciseArm();
+    }
+}
+
+ISR(TCE0_CCA_vect) {
+    if (preciseCallback != NULL) {
+        preciseFire();
+    }
+}
+
+void preciseTimeFireIn(uint32_t millis, uint16_t micros, TimerCallback callback) {
+    uint64_t ticks = (((uint64_t)millis * 1000) + micros) * PRECISE_TICKS_PER_US;
+
+    uint8_t sreg = SREG;
+    cli();
+
+    TCE0.INTCTRLB = TC_CCAINTLVL_OFF_gc;
+    if (preciseFiring) {
+        preciseDeadline += ticks;
+    } else {
+        if (preciseCallback == NULL) {
+            // overflows were not counted while idle, the count is relative
+            TCE0.INTFLAGS = TC0_OVFIF_bm;
+            TCE0.INTCTRLA = TC_OVFINTLVL_HI_gc;
+        }
+        preciseDeadline = preciseNow() + ticks;
+    }
+    preciseCallback = callback;
+    preciseArm();
+
+    SREG = sreg;
+}
+
+void preciseTimeCancel(void) {
+    uint8_t sreg = SREG;
+    cli();
+    TCE0.INTCTRLA = TC_OVFINTLVL_OFF_gc;
+    TCE0.INTCTRLB = TC_CCAINTLVL_OFF_gc;
+    preciseCallback = NULL;
+    SREG = sreg;
 }
 
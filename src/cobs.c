@@ -0,0 +1,86 @@
+/*
+ * cobs.c
+ * avr_pump_board
+ *
+ * Consistent Overhead Byte Stuffing and CRC16 (XMODEM) for the binary
+ * protocol. Each run of up to 254 non-zero bytes is prefixed with a code byte
+ * holding its length plus one. A code below 0xFF implies a zero byte after the
+ * run, except at the end of the frame.
+ *
+ * Copyright (c) 2017 Thomas Buck <xythobuz@xythobuz.de>
+ * All rights reserved.
+ */
+
+#include <stdint.h>
+
+#include "cobs.h"
+
+uint16_t cobsEncode(const uint8_t *src, uint16_t len, uint8_t *dst) {
+    uint16_t codeIndex = 0;
+    uint16_t n = 1;
+    uint8_t code = 1;
+
+    for (uint16_t i = 0; i < len; i++) {
+        if (src[i] == 0) {
+            dst[codeIndex] = code;
+            codeIndex = n++;
+            code = 1;
+        } else {
+            dst[n++] = src[i];
+            code++;
+            if ((code == 0xFF) && (i < (len - 1))) {
+                dst[codeIndex] = code;
+                codeIndex = n++;
+                code = 1;
+            }
+        }
+    }
+
+    dst[codeIndex] = code;
+    return n;
+}
+
+uint16_t cobsDecode(const uint8_t *src, uint16_t len, uint8_t *dst) {
+    uint16_t in = 0, out = 0;
+
+    while (in < len) {
+        uint8_t code = src[in++];
+        if ((code == 0) || ((in + code - 1) > len)) {
+            return 0;
+        }
+
+        for (uint8_t i = 1; i < code; i++) {
+            if (src[in] == 0) {
+                return 0;
+            }
+            dst[out++] = src[in++];
+        }
+
+        if ((code < 0xFF) && (in < len)) {
+            dst[out++] = 0;
+        }
+    }
+
+    return out;
+}
+
+uint16_t crc16Update(uint16_t crc, uint8_t data) {
+    crc ^= (uint16_t)data << 8;
+    for (uint8_t i = 0; i < 8; i++) {
+        if (crc & 0x8000) {
+            crc = (crc << 1) ^ 0x1021;
+        } else {
+            crc <<= 1;
+        }
+    }
+    return crc;
+}
+
+uint16_t crc16(const uint8_t *data, uint16_t len) {
+    uint16_t crc = 0;
+    for (uint16_t i = 0; i < len; i++) {
+        crc = crc16Update(crc, data[i]);
+    }
+    return crc;
+}
+
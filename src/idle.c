@@ -0,0 +1,146 @@
+/*
+ * idle.c
+ * avr_pump_board
+ *
+ * The CPU sleeps in IDLE mode whenever the main loop has nothing to do.
+ * Timers, DMA and the UART keep running, and any interrupt wakes us up.
+ *
+ * Received bytes are written to the buffer by the DMA, without an
+ * interrupt, so a falling edge on the host RX pin (PC6) wakes us instead.
+ * That edge is the start bit, the byte itself arrives one frame later.
+ * So after RX activity, a timer wakes us once more IDLE_RX_LINGER ms
+ * after falling asleep, to catch frames that were still incoming.
+ *
+ * Copyright (c) 2017 Thomas Buck <xythobuz@xythobuz.de>
+ * All rights reserved.
+ */
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+#include <stdint.h>
+
+#include "clock.h"
+#include "serial.h"
+#include "task.h"
+#include "idle.h"
+
+// longer than one frame at 9600 baud
+#define IDLE_RX_LINGER 2
+
+static volatile uint8_t idleWork = 0;
+static volatile uint8_t idleSleeping = 0;
+static volatile uint8_t idleRxActive = 0;
+static volatile uint32_t idleWakeTime = 0;
+static uint8_t idleLingerTimer = TIMER_INVALID;
+
+static uint64_t idleSince = 0; // ms
+static uint64_t idleAsleep = 0; // us
+static uint32_t idleWakeups = 0;
+static uint64_t idleLatencySum = 0;
+static uint32_t idleLatencyCount = 0;
+static uint32_t idleLatencyMax = 0;
+
+void idleInit(void) {
+    set_sleep_mode(SLEEP_MODE_IDLE);
+
+    // start bits on the host link, only armed while sleeping
+    PORTC.PIN6CTRL = PORT_ISC_FALLING_gc;
+    PORTC.INT0MASK = PIN6_bm;
+    PORTC.INTCTRL = PORT_INT0LVL_OFF_gc;
+
+    idleSince = getSystemTime();
+}
+
+void idleWake(void) {
+    uint8_t sreg = SREG;
+    cli();
+    if (idleSleeping) {
+        idleSleeping = 0;
+        idleWakeTime = getSystemMicros();
+    }
+    idleWork = 1;
+    SREG = sreg;
+}
+
+static void idleLinger(void) {
+    idleLingerTimer = TIMER_INVALID;
+    taskReady(TASK_INTERFACE);
+}
+
+ISR(PORTC_INT0_vect) {
+    PORTC.INTCTRL = PORT_INT0LVL_OFF_gc;
+    idleRxActive = 1;
+    taskReady(TASK_INTERFACE);
+}
+
+void idleSleep(void) {
+    // an interrupt from here on wakes us right after sleep_cpu()
+    cli();
+    if (serialHasChar(1)) {
+        taskReady(TASK_INTERFACE);
+    }
+    if (idleWork) {
+        idleWork = 0;
+        sei();
+        return;
+    }
+
+    if (idleRxActive) {
+        idleRxActive = 0;
+        timerCancel(idleLingerTimer);
+        idleLingerTimer = timerStart(IDLE_RX_LINGER, idleLinger, 0);
+    }
+
+    PORTC.INTFLAGS = PORT_INT0IF_bm;
+    PORTC.INTCTRL = PORT_INT0LVL_LO_gc;
+
+    uint32_t start = getSystemMicros();
+    idleSleeping = 1;
+    sleep_enable();
+    sei();
+    sleep_cpu();
+    sleep_disable();
+
+    cli();
+    uint32_t now = getSystemMicros();
+    if (idleSleeping) {
+        // woken by an interrupt that left no work for us
+        idleSleeping = 0;
+        idleWakeTime = now;
+    } else {
+        uint32_t latency = now - idleWakeTime;
+        idleLatencySum += latency;
+        idleLatencyCount++;
+        if (latency > idleLatencyMax) {
+            idleLatencyMax = latency;
+        }
+    }
+    idleAsleep += idleWakeTime - start;
+    idleWakeups++;
+    idleWork = 0;
+    sei();
+}
+
+void idleStatistics(IdleStatistics *stats, uint8_t reset) {
+    uint64_t now = getSystemTime();
+
+    uint8_t sreg = SREG;
+    cli();
+    stats->elapsed = now - idleSince;
+    stats->asleep = idleAsleep / 1000;
+    stats->wakeups = idleWakeups;
+    stats->latencyAverage = idleLatencyCount ? (idleLatencySum / idleLatencyCount) : 0;
+    stats->latencyMax = idleLatencyMax;
+
+    if (reset) {
+        idleSince = now;
+        idleAsleep = 0;
+        idleWakeups = 0;
+        idleLatencySum = 0;
+        idleLatencyCount = 0;
+        idleLatencyMax = 0;
+    }
+    SREG = sreg;
+}
+
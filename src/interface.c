@@ -6,16 +6,35 @@
  * master device to control the system.
  *
  * Each command consists of one character identifying the action to be
- * executed, prefixed by an arbitrary string set in this module, followed by
- * an optional unnamed parameter. The command ends with a new-line (\n).
- * Only ASCII decimal numbers are supported as parameters.
+ * executed, followed by an optional unnamed parameter and the optional named
+ * parameters listed for this command, each a letter followed by a number.
+ * A line starts with an arbitrary prefix string set in this module, can
+ * contain any number of commands and ends with a new-line (\n). The commands
+ * are executed in order. If one fails, the rest of the line is skipped and
+ * the failing command is reported.
+ * Only ASCII decimal numbers up to 32bit are supported as parameters.
  *
  * For example, if the prefix is set to "$$":
  *     $$v\n - Show the version information
  *     $$p10\n - Set pump 10 as state for the next command
+ *     $$rp3d1500p7d800w200g\n - Dispense a recipe with two ingredients
+ *     $$k1rp4d900g\n - Dispense a recipe in slot 1 at the same time
+ *     $$e10P3W4\n - Power budget of 10, pump 3 draws 4 of it
+ *
+ * Named parameters are case sensitive. Those of commands other than p are
+ * upper case letters, so they do not hide the lower case commands that may
+ * follow on the same line.
+ *
+ * In machine mode ($$m1\n) there is no echo and no prompt. Every line is
+ * answered with exactly one of
+ *     OK\n or OK value\n - all commands succeeded, some return a value
+ *     ERR code index\n - command number index failed with a STATUS_ code
+ * and, when a recipe has been dispensed completely, DONE\n is sent. For
+ * recipes in slots other than 0, the slot follows: DONE slot\n.
  *
  * The implementation of the methods is done in this module, too.
- * They are then included in the commands[] list.
+ * They are then included in the INTERFACE_COMMANDS list, from which both
+ * the help text and the dispatch table in flash are generated.
  *
  * Copyright (c) 2017 Thomas Buck <xythobuz@xythobuz.de>
  * All rights reserved.
@@ -23,186 +42,882 @@
 
 #include <avr/io.h>
 #include <avr/interrupt.h>
+#include <avr/pgmspace.h>
 #include <stdint.h>
+#include <stdlib.h>
 
 #include "config.h"
+#include "status.h"
+#include "clock.h"
 #include "serial.h"
 #include "recipe.h"
 #include "pumps.h"
 #include "lights.h"
+#include "protocol.h"
 #include "interface.h"
+#include "idle.h"
+#include "task.h"
 
 // ----------------------------------------------------------------------------
 // Implementation of interface functions
 // optional parameters are given as parameter - if they exist
 
-#define printHelp(c, desc) serialWriteString(1, "  " COMMAND_PREFIX c "  - " desc "\n")
-static void methodHelp(uint16_t arg) {
-    serialWriteString(1, "Available commands:\n");
-    printHelp("h", "Print this help text");
-    printHelp("v", "Print version information");
-    printHelp("r", "Reset recipe list");
-    printHelp("pX", "Set pump X for current recipe ingredient");
-    printHelp("dX", "Set duration to X milliseconds for current recipe ingredient");
-    printHelp("wX", "Wait for X milliseconds before starting this recipe ingredient");
-    printHelp("s", "Store current recipe ingredient and go to next one");
-    printHelp("g", "Go and dispense currently entered recipe");
-    printHelp("l", "List currently entered recipe ingredients");
-    printHelp("cX", "Start or stop cleaning cycle for all pumps (0 or 1)");
-    printHelp("nX", "Turn on pump X");
-    printHelp("fX", "Turn off pump X");
-    printHelp("q", "Debug helper");
-}
-
-static void methodVersion(uint16_t arg) {
-    serialWriteString(1, TARGET_ID " firmware " VERSION_ID "\n");
-    serialWriteString(1, "by " AUTHOR_ID " - build date:\n");
-    serialWriteString(1, __DATE__ " - " __TIME__ "\n");
-}
-
-static void methodClean(uint16_t arg) {
-    if (arg) {
-        pumpsClean(1);
+// Command character (lower case, upper case works too), method, letters of
+// the named parameters it accepts, parameter and description for the help text.
+// Names are case sensitive and take precedence over the commands, so upper
+// case ones keep the lower case command of the same letter usable.
+#define INTERFACE_COMMANDS(X) \
+    X('h', methodHelp, "", "", "Print this help text") \
+    X('v', methodVersion, "", "", "Print version information") \
+    X('k', methodSlot, "", "X", "Select recipe slot X for the recipe commands, slots using different pumps run at once (none: show)") \
+    X('r', methodReset, "", "", "Reset recipe list") \
+    X('p', methodPump, "dw", "X[dY][wZ]", "Set pump X for current recipe ingredient, with d or w: store it") \
+    X('d', methodDuration, "", "X", "Set duration to X milliseconds for current recipe ingredient") \
+    X('w', methodDelay, "", "X", "Wait for X milliseconds before starting this recipe ingredient") \
+    X('j', methodAlign, "", "X", "Align the ingredients of this recipe at their start (0), end (1) or center (2), delays are added") \
+    X('s', methodStore, "", "", "Store current recipe ingredient and go to next one") \
+    X('g', methodGo, "", "", "Go and dispense the recipe in the selected slot, in the background") \
+    X('t', methodStatus, "", "", "Show running pumps, their remaining time and the slots dispensing") \
+    X('a', methodAbort, "", "X", "Abort the recipe in slot X, turn off its pumps (none: abort everything, turn off all pumps)") \
+    X('l', methodList, "", "", "List currently entered recipe ingredients") \
+    X('c', methodClean, "MSONP", "X[MY][SA][OB][NC][PD]", \
+            "Start (1) or stop (0) cleaning pump set Y (all), A ms apart, " \
+            "each for B ms (0: until stopped), C cycles with D ms pause") \
+    X('e', methodBudget, "PW", "X[PY][WZ]", "Power budget of X for a recipe, with P and W: pump Y draws Z (none: show)") \
+    X('n', methodPumpOn, "M", "X[MY]", "Turn on pump X and/or pump set Y (bit 0: pump 1)") \
+    X('f', methodPumpOff, "M", "X[MY]", "Turn off pump X and/or pump set Y (bit 0: pump 1)") \
+    X('b', methodBaud, "", "X", "Switch to X * 100 baud, confirm with the next line at the new rate (none: show)") \
+    X('m', methodMode, "", "X", "Machine mode: no echo or prompt, replies OK/ERR (0 or 1)") \
+    X('i', methodIdle, "", "", "Show time spent asleep and wake-up latency since the last call") \
+    X('u', methodUsage, "", "", "Show CPU usage of each task since the last call") \
+    X('x', methodBinary, "", "1", "Switch to the binary protocol") \
+    X('q', methodDebug, "", "", "Debug helper")
+
+// Additional command characters
+#define INTERFACE_ALIASES(X) \
+    X('?', methodHelp)
+
+static uint8_t machineMode = 0;
+static uint32_t replyValue = 0;
+static uint8_t replyValueSet = 0;
+
+// Value sent with the OK token in machine mode
+static void interfaceReplyValue(uint32_t value) {
+    replyValue = value;
+    replyValueSet = 1;
+}
+
+#define HELP_ENTRY(c, method, names, param, desc) \
+    serialWriteLiteral(1, "  " COMMAND_PREFIX); \
+    serialWrite(1, c); \
+    serialWriteLiteral(1, param "  - " desc "\n");
+
+static uint8_t methodHelp(const InterfaceArgs *args) {
+    serialWriteLiteral(1, "Available commands:\n");
+    INTERFACE_COMMANDS(HELP_ENTRY)
+    return STATUS_OK;
+}
+
+static uint8_t methodVersion(const InterfaceArgs *args) {
+    serialWriteLiteral(1, TARGET_ID " firmware " VERSION_ID "\n");
+    serialWriteLiteral(1, "by " AUTHOR_ID " - build date:\n");
+    serialWriteLiteral(1, __DATE__ " - " __TIME__ "\n");
+    return STATUS_OK;
+}
+
+static uint8_t methodSlot(const InterfaceArgs *args) {
+    if (args->given & INTERFACE_GIVEN_VALUE) {
+        return recipeSelect(args->value);
+    }
+
+    if (!machineMode) {
+        serialWriteLiteral(1, "Selected slot ");
+        serialWriteInt16(1, recipeSelected());
+        serialWriteLiteral(1, " of ");
+        serialWriteInt16(1, RECIPE_SLOTS);
+        serialWriteLiteral(1, "\n");
+    }
+    interfaceReplyValue(recipeSelected());
+    return STATUS_OK;
+}
+
+static uint8_t methodReset(const InterfaceArgs *args) {
+    return recipeReset();
+}
+
+static uint8_t methodPump(const InterfaceArgs *args) {
+    uint8_t status = recipePump(args->value);
+    if ((status == STATUS_OK) && (args->given & INTERFACE_GIVEN_NAMED(0))) {
+        status = recipeDuration(args->named[0]);
+    }
+    if ((status == STATUS_OK) && (args->given & INTERFACE_GIVEN_NAMED(1))) {
+        status = recipeDelay(args->named[1]);
+    }
+
+    // the whole ingredient in one command
+    if ((status == STATUS_OK)
+            && (args->given & (INTERFACE_GIVEN_NAMED(0) | INTERFACE_GIVEN_NAMED(1)))) {
+        status = recipeStore();
+        interfaceReplyValue(recipeCount());
+    }
+    return status;
+}
+
+static uint8_t methodDuration(const InterfaceArgs *args) {
+    return recipeDuration(args->value);
+}
+
+static uint8_t methodDelay(const InterfaceArgs *args) {
+    return recipeDelay(args->value);
+}
+
+static uint8_t methodStore(const InterfaceArgs *args) {
+    uint8_t status = recipeStore();
+    interfaceReplyValue(recipeCount());
+    return status;
+}
+
+static uint8_t methodAlign(const InterfaceArgs *args) {
+    return recipeAlign(args->value);
+}
+
+static uint8_t methodGo(const InterfaceArgs *args) {
+    return recipeGo();
+}
+
+static uint8_t methodStatus(const InterfaceArgs *args) {
+    uint32_t mask = pumpsRunningMask();
+    if (machineMode) {
+        interfaceReplyValue(mask);
     } else {
-        pumpsClean(0);
+        serialWriteLiteral(1, "Running pump mask: ");
+        serialWriteInt32(1, mask);
+        serialWriteLiteral(1, "\n");
+    }
+
+    uint8_t slots = pumpsSlots();
+    for (uint8_t i = 0; i < RECIPE_SLOTS; i++) {
+        if (!(slots & (1 << i))) {
+            continue;
+        }
+
+        if (machineMode) {
+            serialWriteLiteral(1, "S ");
+        } else {
+            serialWriteLiteral(1, "Dispensing in slot ");
+        }
+        serialWriteInt16(1, i);
+        serialWriteLiteral(1, "\n");
+    }
+
+    PumpCleanProgress clean;
+    if (pumpsCleanProgress(&clean)) {
+        if (machineMode) {
+            serialWriteLiteral(1, "C ");
+            serialWriteInt16(1, clean.cycle);
+            serialWriteLiteral(1, " ");
+            serialWriteInt16(1, clean.cycles);
+            serialWriteLiteral(1, " ");
+            serialWriteInt16(1, clean.done);
+            serialWriteLiteral(1, " ");
+            serialWriteInt16(1, clean.pumps);
+            serialWriteLiteral(1, " ");
+            serialWriteInt16(1, clean.stopping);
+            serialWriteLiteral(1, "\n");
+        } else {
+            if (clean.stopping) {
+                serialWriteLiteral(1, "Stopping cleaning, ");
+            } else {
+                serialWriteLiteral(1, "Cleaning cycle ");
+                serialWriteInt16(1, clean.cycle);
+                serialWriteLiteral(1, " of ");
+                serialWriteInt16(1, clean.cycles);
+                serialWriteLiteral(1, ", ");
+            }
+            serialWriteInt16(1, clean.done);
+            serialWriteLiteral(1, " of ");
+            serialWriteInt16(1, clean.pumps);
+            serialWriteLiteral(1, " pumps done\n");
+        }
+    }
+
+    for (uint8_t i = 1; i <= 20; i++) {
+        uint32_t remaining = pumpsRemaining(i);
+        if (remaining == 0) {
+            continue;
+        }
+
+        if (machineMode) {
+            serialWriteLiteral(1, "P ");
+            serialWriteInt16(1, i);
+            serialWriteLiteral(1, " ");
+            serialWriteInt32(1, remaining);
+            serialWriteLiteral(1, "\n");
+        } else {
+            serialWriteLiteral(1, "Pump ");
+            serialWriteInt16(1, i);
+            serialWriteLiteral(1, " running for another ");
+            serialWriteInt32(1, remaining);
+            serialWriteLiteral(1, "ms\n");
+        }
+    }
+
+    return STATUS_OK;
+}
+
+// value in hundredths of a percent
+static void printPercent(uint32_t value) {
+    serialWriteInt32(1, value / 100);
+    serialWriteLiteral(1, ".");
+    if ((value % 100) < 10) {
+        serialWriteLiteral(1, "0");
+    }
+    serialWriteInt16(1, value % 100);
+    serialWriteLiteral(1, "%");
+}
+
+static uint8_t methodIdle(const InterfaceArgs *args) {
+    IdleStatistics stats;
+    idleStatistics(&stats, 1);
+    uint32_t percent = stats.elapsed ? ((uint64_t)stats.asleep * 100 / stats.elapsed) : 0;
+
+    if (machineMode) {
+        serialWriteLiteral(1, "I ");
+        serialWriteInt32(1, stats.elapsed);
+        serialWriteLiteral(1, " ");
+        serialWriteInt32(1, stats.asleep);
+        serialWriteLiteral(1, " ");
+        serialWriteInt32(1, stats.wakeups);
+        serialWriteLiteral(1, " ");
+        serialWriteInt32(1, stats.latencyAverage);
+        serialWriteLiteral(1, " ");
+        serialWriteInt32(1, stats.latencyMax);
+        serialWriteLiteral(1, "\n");
+        interfaceReplyValue(percent);
+    } else {
+        serialWriteLiteral(1, "Asleep: ");
+        serialWriteInt32(1, percent);
+        serialWriteLiteral(1, "% of ");
+        serialWriteInt32(1, stats.elapsed);
+        serialWriteLiteral(1, "ms\nWake-ups: ");
+        serialWriteInt32(1, stats.wakeups);
+        serialWriteLiteral(1, "\nLatency: ");
+        serialWriteInt32(1, stats.latencyAverage);
+        serialWriteLiteral(1, "us average, ");
+        serialWriteInt32(1, stats.latencyMax);
+        serialWriteLiteral(1, "us max\n");
+    }
+
+    return STATUS_OK;
+}
+
+static uint8_t methodUsage(const InterfaceArgs *args) {
+    TaskStatistics stats[TASK_COUNT];
+    uint64_t elapsed = taskStatistics(stats, 1);
+
+    if (!machineMode) {
+        serialWriteLiteral(1, "CPU usage of the last ");
+        serialWriteInt32(1, elapsed / (F_CPU / 1000));
+        serialWriteLiteral(1, "ms:\n");
+    }
+
+    for (uint8_t i = 0; i < TASK_COUNT; i++) {
+        uint32_t usage = elapsed ? (stats[i].cycles * 10000 / elapsed) : 0;
+        uint32_t micros = stats[i].cycles / (F_CPU / 1000000);
+        uint32_t maxMicros = stats[i].maxCycles / (F_CPU / 1000000);
+
+        if (machineMode) {
+            serialWriteLiteral(1, "U ");
+            serialWriteString(1, stats[i].name);
+            serialWriteLiteral(1, " ");
+            serialWriteInt32(1, stats[i].runs);
+            serialWriteLiteral(1, " ");
+            serialWriteInt32(1, micros);
+            serialWriteLiteral(1, " ");
+            serialWriteInt32(1, maxMicros);
+            serialWriteLiteral(1, "\n");
+        } else {
+            serialWriteString(1, stats[i].name);
+            serialWriteLiteral(1, ": ");
+            printPercent(usage);
+            serialWriteLiteral(1, " in ");
+            serialWriteInt32(1, stats[i].runs);
+            serialWriteLiteral(1, " runs, longest ");
+            serialWriteInt32(1, maxMicros);
+            serialWriteLiteral(1, "us\n");
+        }
+    }
+
+    if (machineMode) {
+        interfaceReplyValue(elapsed / (F_CPU / 1000));
+    }
+    return STATUS_OK;
+}
+
+static uint8_t methodAbort(const InterfaceArgs *args) {
+    if (args->given & INTERFACE_GIVEN_VALUE) {
+        if (args->value >= RECIPE_SLOTS) {
+            return STATUS_INVALID_PARAMETER;
+        }
+        return pumpsAbortSlot(args->value);
+    }
+    return pumpsAbort();
+}
+
+static uint8_t methodList(const InterfaceArgs *args) {
+    return recipeList();
+}
+
+// Pump X and the pumps in mask Y, all switched at once
+static uint8_t pumpArgsMask(const InterfaceArgs *args, uint32_t *mask) {
+    *mask = 0;
+    if (args->given & INTERFACE_GIVEN_NAMED(0)) {
+        *mask = args->named[0];
+    }
+
+    if (args->given & INTERFACE_GIVEN_VALUE) {
+        if ((args->value < 1) || (args->value > 20)) {
+            return STATUS_INVALID_PUMP;
+        }
+        *mask |= PUMP_MASK(args->value);
+    }
+
+    if ((*mask == 0) || (*mask & ~PUMPS_ALL_MASK)) {
+        return STATUS_INVALID_PUMP;
+    }
+    return STATUS_OK;
+}
+
+static uint8_t methodPumpOn(const InterfaceArgs *args) {
+    uint32_t mask;
+    uint8_t status = pumpArgsMask(args, &mask);
+    if (status == STATUS_OK) {
+        status = pumpsSwitch(mask, 0);
+    }
+    return status;
+}
+
+static uint8_t methodPumpOff(const InterfaceArgs *args) {
+    uint32_t mask;
+    uint8_t status = pumpArgsMask(args, &mask);
+    if (status == STATUS_OK) {
+        status = pumpsSwitch(0, mask);
+    }
+    return status;
+}
+
+static uint8_t methodClean(const InterfaceArgs *args) {
+    if (!args->value) {
+        return pumpsCleanStop();
+    }
+
+    PumpCleanConfig config = PUMP_CLEAN_DEFAULTS;
+    if (args->given & INTERFACE_GIVEN_NAMED(0)) {
+        config.mask = args->named[0];
+    }
+    if (args->given & INTERFACE_GIVEN_NAMED(1)) {
+        if (args->named[1] > 0xFFFF) {
+            return STATUS_INVALID_TIME;
+        }
+        config.stagger = args->named[1];
+    }
+    if (args->given & INTERFACE_GIVEN_NAMED(2)) {
+        config.onTime = args->named[2];
+    }
+    if (args->given & INTERFACE_GIVEN_NAMED(3)) {
+        if (args->named[3] > 0xFFFF) {
+            return STATUS_INVALID_PARAMETER;
+        }
+        config.cycles = args->named[3];
+    }
+    if (args->given & INTERFACE_GIVEN_NAMED(4)) {
+        config.pause = args->named[4];
+    }
+
+    return pumpsCleanStart(&config);
+}
+
+static uint8_t methodBudget(const InterfaceArgs *args) {
+    uint8_t given = args->given & (INTERFACE_GIVEN_NAMED(0) | INTERFACE_GIVEN_NAMED(1));
+    if ((given == 0) && !(args->given & INTERFACE_GIVEN_VALUE)) {
+        if (machineMode) {
+            serialWriteLiteral(1, "W");
+        } else {
+            serialWriteLiteral(1, "Power budget: ");
+            serialWriteInt16(1, pumpsBudget());
+            serialWriteLiteral(1, "\nPump weights:");
+        }
+        for (uint8_t i = 1; i <= 20; i++) {
+            serialWriteLiteral(1, " ");
+            serialWriteInt16(1, pumpsWeight(i));
+        }
+        serialWriteLiteral(1, "\n");
+        interfaceReplyValue(pumpsBudget());
+        return STATUS_OK;
     }
+
+    uint8_t weight[20];
+    for (uint8_t i = 0; i < 20; i++) {
+        weight[i] = pumpsWeight(i + 1);
+    }
+
+    if (given != 0) {
+        if (given != (INTERFACE_GIVEN_NAMED(0) | INTERFACE_GIVEN_NAMED(1))) {
+            return STATUS_INVALID_PARAMETER;
+        }
+        if ((args->named[0] < 1) || (args->named[0] > 20)) {
+            return STATUS_INVALID_PUMP;
+        }
+        if (args->named[1] > 0xFF) {
+            return STATUS_INVALID_PARAMETER;
+        }
+        weight[args->named[0] - 1] = args->named[1];
+    }
+
+    uint32_t budget = pumpsBudget();
+    if (args->given & INTERFACE_GIVEN_VALUE) {
+        if (args->value > 0xFFFF) {
+            return STATUS_INVALID_PARAMETER;
+        }
+        budget = args->value;
+    }
+
+    return pumpsSetBudget(budget, weight);
+}
+
+static uint32_t baudCurrent = HOST_BAUDRATE;
+static uint32_t baudFallback = 0; // old rate, while the new one is unconfirmed
+static uint8_t baudSwitched = 0; // in the line being received
+static uint64_t baudSwitchTime = 0;
+
+static void printBaud(const SerialBaud *baud) {
+    serialWriteInt32(1, baud->rate);
+    serialWriteLiteral(1, " baud, error ");
+
+    int16_t error = baud->error;
+    if (error < 0) {
+        serialWriteLiteral(1, "-");
+        error = -error;
+    }
+    printPercent(error);
+    serialWriteLiteral(1, "\n");
+}
+
+// check the fallback again once the new rate had its chance
+static void baudTimeout(void) {
+    taskReady(TASK_INTERFACE);
+}
+
+static uint8_t methodBaud(const InterfaceArgs *args) {
+    SerialBaud baud;
+
+    if (args->value == 0) {
+        if (machineMode) {
+            interfaceReplyValue(baudCurrent);
+        } else {
+            serialBaudCalculate(baudCurrent, &baud);
+            printBaud(&baud);
+        }
+        return STATUS_OK;
+    }
+
+    if ((args->value > (0xFFFFFFFFul / 100))
+            || (serialBaudCalculate(args->value * 100, &baud) != 0)) {
+        return STATUS_INVALID_BAUDRATE;
+    }
+
+    // in machine mode, OK is sent at the new rate
+    if (!machineMode) {
+        serialWriteLiteral(1, "Switching to ");
+        printBaud(&baud);
+    }
+    serialFlush(1);
+    serialSetBaud(1, &baud);
+
+    // wait for the host to confirm the new rate
+    if (baudFallback == 0) {
+        baudFallback = baudCurrent;
+    }
+    baudCurrent = args->value * 100;
+    baudSwitchTime = getSystemTime();
+    baudSwitched = 1;
+    timerStart(BAUDRATE_FALLBACK_TIMEOUT + 1, baudTimeout, 0);
+    return STATUS_OK;
+}
+
+static uint8_t baudCheckFallback(void) {
+    if ((baudFallback == 0)
+            || ((getSystemTime() - baudSwitchTime) <= BAUDRATE_FALLBACK_TIMEOUT)) {
+        return 0;
+    }
+
+    SerialBaud baud;
+    serialBaudCalculate(baudFallback, &baud);
+    serialFlush(1);
+    serialSetBaud(1, &baud);
+    baudCurrent = baudFallback;
+    baudFallback = 0;
+
+    serialWriteLiteral(1, "\nError: new baudrate not confirmed, switched back to ");
+    printBaud(&baud);
+    return 1;
 }
 
-static void methodDebug(uint16_t arg) {
-    serialWriteString(1, "Refreshing RGB LEDs...\n");
+static uint8_t methodMode(const InterfaceArgs *args) {
+    if (args->value > 1) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    machineMode = args->value;
+    return STATUS_OK;
+}
+
+static uint8_t methodBinary(const InterfaceArgs *args) {
+    if (args->value != 1) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    protocolStart();
+    return STATUS_OK;
+}
+
+static uint8_t methodDebug(const InterfaceArgs *args) {
+    serialWriteLiteral(1, "Refreshing RGB LEDs...\n");
     lightsDisplayBuffer();
+    return STATUS_OK;
 }
 
 // ----------------------------------------------------------------------------
 
-typedef void (*InterfaceMethod)(uint16_t arg);
-
-#define MAX_CHARS_PER_COMMAND 3
+typedef uint8_t (*InterfaceMethod)(const InterfaceArgs *args);
 
 typedef struct {
-    uint8_t chars[MAX_CHARS_PER_COMMAND];
-    InterfaceMethod callback;
+    InterfaceMethod method;
+    char names[INTERFACE_MAX_NAMED]; // named parameter letters, not terminated
 } InterfaceCommand;
 
-InterfaceCommand commands[] = {
-    { { 'h', 'H', '?' }, methodHelp },
-    { { 'v', 'V',  0  }, methodVersion },
-    { { 'r', 'R',  0  }, recipeReset },
-    { { 'p', 'P',  0  }, recipePump },
-    { { 'd', 'D',  0  }, recipeDuration },
-    { { 'w', 'W',  0  }, recipeDelay },
-    { { 's', 'S',  0  }, recipeStore },
-    { { 'g', 'G',  0  }, recipeGo },
-    { { 'l', 'L',  0  }, recipeList },
-    { { 'c', 'C',  0  }, methodClean },
-    { { 'n', 'N',  0  }, pumpOn },
-    { { 'f', 'F',  0  }, pumpOff },
-    { { 'q',  0,   0  }, methodDebug }
+#define COMMAND_ENUM(c, method, names, param, desc) COMMAND_##method,
+#define COMMAND_ENTRY(c, method, names, param, desc) { method, names },
+#define DISPATCH_ENTRY(c, method, names, param, desc) \
+    [c] = COMMAND_##method, [(c) - 'a' + 'A'] = COMMAND_##method,
+#define DISPATCH_ALIAS(c, method) [c] = COMMAND_##method,
+
+enum {
+    COMMAND_NONE = 0,
+    INTERFACE_COMMANDS(COMMAND_ENUM)
+};
+
+static const InterfaceCommand commands[] PROGMEM = {
+    { NULL, "" },
+    INTERFACE_COMMANDS(COMMAND_ENTRY)
+};
+
+// Indexed by the command character, unused characters are COMMAND_NONE
+static const uint8_t dispatch[128] PROGMEM = {
+    INTERFACE_COMMANDS(DISPATCH_ENTRY)
+    INTERFACE_ALIASES(DISPATCH_ALIAS)
 };
-static const uint8_t commandCount = sizeof(commands) / sizeof(InterfaceCommand);
 
-#define STATE_RESET 0
-#define STATE_READING 1
+#define STATE_RESET 0 // print prompt, then start a new line
+#define STATE_PREFIX 1 // matching the command prefix
+#define STATE_COMMAND 2 // waiting for a command character
+#define STATE_PARAMETER 3 // command character received, reading parameters
+#define STATE_SKIP 4 // a command failed, ignore the rest of the line
 static uint8_t state = STATE_RESET;
 
 #define PREFIX_LEN ((sizeof(COMMAND_PREFIX) / sizeof(char)) - 1)
-#define MAX_PARAMETER_LEN 6
-#define BUF_LEN (MAX_PARAMETER_LEN + PREFIX_LEN + 10)
-static uint8_t lineBuffer[BUF_LEN];
-static uint8_t lineBufferLen = 0;
-
-void interfaceHandler(uint8_t c, uint16_t arg) {
-    for (uint8_t i = 0; i < commandCount; i++) {
-        for (uint8_t j = 0; j < MAX_CHARS_PER_COMMAND; j++) {
-            if (commands[i].chars[j] == c) {
-                commands[i].callback(arg);
-                return;
-            }
+static uint8_t prefixMatched = 0;
+
+static uint8_t command = 0;
+static uint8_t commandEntry = COMMAND_NONE;
+static InterfaceArgs commandArgs;
+static uint32_t *parameter = &commandArgs.value;
+static uint8_t parameterOverflow = 0;
+static uint8_t commandIndex = 0;
+static uint8_t lineStatus = STATUS_OK;
+static uint8_t lineContinued = 0;
+
+void interfacePrintStatus(uint8_t status) {
+    switch (status) {
+        case STATUS_OK:
+            return;
+        case STATUS_UNKNOWN_COMMAND:
+            serialWriteLiteral(1, "Error: unknown command!\n");
+            break;
+        case STATUS_INVALID_PREFIX:
+            serialWriteLiteral(1, "Error: invalid command prefix!\n");
+            break;
+        case STATUS_INVALID_PARAMETER:
+            serialWriteLiteral(1, "Error: invalid parameter!\n");
+            break;
+        case STATUS_PARAMETER_TOO_LONG:
+            serialWriteLiteral(1, "Error: parameter is too long!\n");
+            break;
+        case STATUS_LINE_TOO_LONG:
+            serialWriteLiteral(1, "Error: command line buffer will overflow!\n");
+            break;
+        case STATUS_INVALID_PUMP:
+            serialWriteLiteral(1, "Error: invalid pump id!\n");
+            break;
+        case STATUS_INVALID_TIME:
+            serialWriteLiteral(1, "Error: only positive integer times are allowed!\n");
+            break;
+        case STATUS_TOO_MANY_INGREDIENTS:
+            serialWriteLiteral(1, "Error: too many ingredients in recipe!\n");
+            break;
+        case STATUS_INCOMPLETE_INGREDIENT:
+            serialWriteLiteral(1, "Error: can't store without pump and time!\n");
+            break;
+        case STATUS_NO_INGREDIENTS:
+            serialWriteLiteral(1, "Error: no ingredients stored!\n");
+            break;
+        case STATUS_PUMPS_RUNNING:
+            serialWriteLiteral(1, "Error: can't do this while pumps are running!\n");
+            break;
+        case STATUS_PUMPS_IDLE:
+            serialWriteLiteral(1, "Error: can't stop, nothing is running!\n");
+            break;
+        case STATUS_INVALID_BAUDRATE:
+            serialWriteLiteral(1, "Error: baudrate not possible!\n");
+            break;
+        case STATUS_PUMPS_OVERLAP:
+            serialWriteLiteral(1, "Error: pumps are in use by a recipe in another slot!\n");
+            break;
+        default:
+            serialWriteLiteral(1, "Error: code ");
+            serialWriteInt16(1, status);
+            serialWriteLiteral(1, "!\n");
+            break;
+    }
+}
+
+static uint8_t interfaceLookup(uint8_t c) {
+    if (c >= sizeof(dispatch)) {
+        return COMMAND_NONE;
+    }
+    return pgm_read_byte(&dispatch[c]);
+}
+
+// Returns the position of named parameter c, or INTERFACE_MAX_NAMED
+static uint8_t interfaceNamedIndex(uint8_t entry, uint8_t c) {
+    for (uint8_t i = 0; i < INTERFACE_MAX_NAMED; i++) {
+        if (pgm_read_byte(&commands[entry].names[i]) == c) {
+            return i;
         }
     }
+    return INTERFACE_MAX_NAMED;
+}
+
+uint8_t interfaceHandler(uint8_t c, const InterfaceArgs *args) {
+    uint8_t entry = interfaceLookup(c);
+    if (entry == COMMAND_NONE) {
+        return STATUS_UNKNOWN_COMMAND;
+    }
 
-    serialWriteString(1, "Error: unknown command!\n");
+    InterfaceArgs noArgs = { 0 };
+    if (args == NULL) {
+        args = &noArgs;
+    }
+
+    InterfaceMethod method = (InterfaceMethod)pgm_read_ptr(&commands[entry].method);
+    return method(args);
 }
 
-static uint16_t convertAsciiToInt(uint8_t *s, uint8_t l) {
-    uint16_t res = 0;
-    for (uint8_t i = 0, n = l - 1; i < l; i++, n--) {
-        uint16_t x = 1;
-        for (uint8_t j = 0; j < n; j++) {
-            x *= 10;
+// Executes the pending command, returns 0 if it succeeded
+static uint8_t interfaceExecute(void) {
+    if (parameterOverflow) {
+        lineStatus = STATUS_PARAMETER_TOO_LONG;
+    } else {
+        lineStatus = interfaceHandler(command, &commandArgs);
+    }
+
+    if (lineStatus != STATUS_OK) {
+        state = STATE_SKIP;
+        return 1;
+    }
+    return 0;
+}
+
+static void interfaceEndLine(void) {
+    if (machineMode) {
+        if (lineStatus == STATUS_OK) {
+            serialWriteLiteral(1, "OK");
+            if (replyValueSet) {
+                serialWriteLiteral(1, " ");
+                serialWriteInt32(1, replyValue);
+            }
+        } else {
+            serialWriteLiteral(1, "ERR ");
+            serialWriteInt16(1, lineStatus);
+            serialWriteLiteral(1, " ");
+            serialWriteInt16(1, commandIndex);
         }
-        res += (s[i] - '0') * x;
+        serialWriteLiteral(1, "\n");
+    } else if (lineStatus != STATUS_OK) {
+        if ((commandIndex > 1) || lineContinued) {
+            serialWriteLiteral(1, "Command ");
+            serialWriteInt16(1, commandIndex);
+            serialWriteLiteral(1, " (");
+            serialWrite(1, command);
+            serialWriteLiteral(1, ") failed, rest of line skipped\n");
+        }
+        interfacePrintStatus(lineStatus);
     }
-    return res;
+    state = STATE_RESET;
 }
 
-static void interfaceHandleLine(void) {
-    if (lineBufferLen < (PREFIX_LEN + 1)) {
+static void interfaceStartCommand(uint8_t c) {
+    command = c;
+    commandEntry = interfaceLookup(c);
+    commandArgs.value = 0;
+    commandArgs.given = 0;
+    parameter = &commandArgs.value;
+    parameterOverflow = 0;
+    commandIndex++;
+    state = STATE_PARAMETER;
+}
+
+static void interfaceDigit(uint8_t digit) {
+    if (parameter == &commandArgs.value) {
+        commandArgs.given |= INTERFACE_GIVEN_VALUE;
+    }
+
+    if ((*parameter > (0xFFFFFFFFul / 10))
+            || ((*parameter == (0xFFFFFFFFul / 10)) && (digit > (0xFFFFFFFFul % 10)))) {
+        parameterOverflow = 1;
+    } else {
+        *parameter = (*parameter * 10) + digit;
+    }
+}
+
+static void interfaceParse(uint8_t c) {
+    if (c == '\r') {
         return;
     }
 
-    for (uint8_t i = 0; i < PREFIX_LEN; i++) {
-        if (lineBuffer[i] != COMMAND_PREFIX[i]) {
-            serialWriteString(1, "Error: invalid command prefix!\n");
-            return;
+    if (state == STATE_PREFIX) {
+        if (c == '\n') {
+            // empty line, or only part of the prefix
+            interfaceEndLine();
+        } else if (c != COMMAND_PREFIX[prefixMatched]) {
+            lineStatus = STATUS_INVALID_PREFIX;
+            state = STATE_SKIP;
+        } else if (++prefixMatched >= PREFIX_LEN) {
+            state = STATE_COMMAND;
+        }
+    } else if (state == STATE_COMMAND) {
+        if (c == '\n') {
+            interfaceEndLine();
+        } else {
+            interfaceStartCommand(c);
         }
+    } else if (state == STATE_PARAMETER) {
+        uint8_t named;
+        if ((c >= '0') && (c <= '9')) {
+            interfaceDigit(c - '0');
+        } else if (c == '\n') {
+            interfaceExecute();
+            interfaceEndLine();
+        } else if ((named = interfaceNamedIndex(commandEntry, c)) < INTERFACE_MAX_NAMED) {
+            commandArgs.named[named] = 0;
+            commandArgs.given |= INTERFACE_GIVEN_NAMED(named);
+            parameter = &commandArgs.named[named];
+        } else if (interfaceExecute()) {
+            lineContinued = 1;
+        } else {
+            interfaceStartCommand(c);
+        }
+    } else if (state == STATE_SKIP) {
+        if (c == '\n') {
+            interfaceEndLine();
+        } else {
+            lineContinued = 1;
+        }
+    } else {
+        serialWriteLiteral(1, "Error: Invalid State!\n");
+        state = STATE_RESET;
     }
+}
 
-    char c = lineBuffer[PREFIX_LEN];
-    uint8_t n = PREFIX_LEN + 1;
-    if (n >= lineBufferLen) {
-        interfaceHandler(c, 0);
-    } else {
-        // There are some bytes left - probably parameters
-        uint8_t digitBuffer[MAX_PARAMETER_LEN];
-        uint8_t digitIndex = 0;
-        while (n < lineBufferLen) {
-            if ((lineBuffer[n] < '0') || (lineBuffer[n] > '9')) {
-                serialWriteString(1, "Error: non-ASCII-digit parameter!\n");
-                return;
+static void interfaceCheckFinished(void) {
+    uint8_t finished, slot = 0;
+    while ((finished = pumpsFinished(&slot)) != PUMPS_FINISHED_NONE) {
+        if (finished == PUMPS_FINISHED_CLEAN) {
+            slot = 0;
+        }
+
+        if (protocolActive()) {
+            protocolEvent(PROTOCOL_EVENT_DONE, slot);
+        } else if (machineMode) {
+            serialWriteLiteral(1, "DONE");
+            if (slot != 0) {
+                serialWriteLiteral(1, " ");
+                serialWriteInt16(1, slot);
+            }
+            serialWriteLiteral(1, "\n");
+        } else {
+            if (finished == PUMPS_FINISHED_CLEAN) {
+                serialWriteLiteral(1, "\nCleaning finished!\n");
             } else {
-                digitBuffer[digitIndex] = lineBuffer[n];
-                if (digitIndex < (MAX_PARAMETER_LEN - 1)) {
-                    digitIndex++;
-                } else {
-                    serialWriteString(1, "Error: parameter is too long!\n");
-                    return;
-                }
+                serialWriteLiteral(1, "\nDispensing in slot ");
+                serialWriteInt16(1, slot);
+                serialWriteLiteral(1, " finished!\n");
+            }
+
+            // new prompt, unless something has already been typed
+            if ((state == STATE_COMMAND) && (commandIndex == 0)) {
+                state = STATE_RESET;
             }
-            n++;
         }
-        interfaceHandler(c, convertAsciiToInt(digitBuffer, digitIndex));
     }
 }
 
 void interfaceLoop(void) {
-    if (state == STATE_RESET) {
-        serialWriteString(1, COMMANDLINE_STRING);
-        state = STATE_READING;
-        lineBufferLen = 0;
-    } else if (state == STATE_READING) {
-        if (serialHasChar(1)) {
-            uint8_t c = serialGet(1);
+    if (baudCheckFallback()) {
+        // drop what we received at the wrong baudrate
+        state = STATE_RESET;
+    }
+
+    interfaceCheckFinished();
+
+    if (protocolActive()) {
+        protocolLoop();
+        state = STATE_RESET;
+    } else if (state == STATE_RESET) {
+        if (!machineMode) {
+            serialWriteLiteral(1, COMMANDLINE_STRING);
+        }
+        prefixMatched = 0;
+        commandIndex = 0;
+        lineStatus = STATUS_OK;
+        lineContinued = 0;
+        replyValueSet = 0;
+        state = (PREFIX_LEN > 0) ? STATE_PREFIX : STATE_COMMAND;
+    } else if (serialHasChar(1)) {
+        uint8_t c = serialGet(1);
 
 #ifndef DISABLE_SERIAL_ECHO
+        if (!machineMode) {
             serialWrite(1, c);
+        }
 #endif
 
-            if ((c != '\r') && (c != '\n')) {
-                lineBuffer[lineBufferLen] = c;
-                if (lineBufferLen < (BUF_LEN - 1)) {
-                    lineBufferLen++;
-                } else {
-                    serialWriteString(1, "Error: command line buffer will overflow!\n");
-                }
-            } else if (c == '\n') {
-                interfaceHandleLine();
-                state = STATE_RESET;
+        interfaceParse(c);
+
+        if (c == '\n') {
+            // any line received at a new baudrate confirms it, but not
+            // the one that switched, which the host sent at the old rate
+            if (baudSwitched) {
+                baudSwitched = 0;
+            } else {
+                baudFallback = 0;
             }
         }
-    } else {
-        serialWriteString(1, "Error: Invalid State!\n");
-        state = STATE_RESET;
+    }
+
+    // one character per run, so other tasks get their turn in between
+    if ((!protocolActive()) && ((state == STATE_RESET) || serialHasChar(1))) {
+        taskReady(TASK_INTERFACE);
     }
 }
 
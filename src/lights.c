@@ -35,6 +35,7 @@
 #include "clock.h"
 #include "serial.h"
 #include "lights.h"
+#include "task.h"
 
 #define LED_COUNT 300
 #define LED_FREQ 800000ul // 800kHz as in WS2812 datasheet
@@ -60,20 +61,15 @@ static volatile uint16_t ledBufferPos = 0;
 
 #define DMA_TRANSACTION_INTERRUPT_LEVEL 0x02
 
-void lightsInit(void) {
-    // Set LED pins as output
-    PORTC.DIRSET = PIN0_bm | PIN1_bm | PIN2_bm | PIN3_bm | PIN4_bm | PIN5_bm;
-    PORTD.DIRSET = PIN0_bm | PIN1_bm | PIN2_bm | PIN3_bm | PIN4_bm | PIN5_bm;
-    PORTE.DIRSET = PIN0_bm | PIN1_bm | PIN2_bm | PIN3_bm | PIN4_bm | PIN5_bm;
-    PORTF.DIRSET = PIN0_bm | PIN1_bm | PIN2_bm | PIN3_bm | PIN4_bm;
+static volatile uint8_t dmaLent = 0;
+static uint8_t dmaConfigured = 0;
 
-    // Disable LEDs on init
-    PORTC.OUTCLR = PIN0_bm | PIN1_bm | PIN2_bm | PIN3_bm | PIN4_bm | PIN5_bm;
-    PORTD.OUTCLR = PIN0_bm | PIN1_bm | PIN2_bm | PIN3_bm | PIN4_bm | PIN5_bm;
-    PORTE.OUTCLR = PIN0_bm | PIN1_bm | PIN2_bm | PIN3_bm | PIN4_bm | PIN5_bm;
-    PORTF.OUTCLR = PIN0_bm | PIN1_bm | PIN2_bm | PIN3_bm | PIN4_bm;
+// refresh requested by lightsDisplayBuffer(), started by lightsTask()
+static uint8_t ledRefresh = 0;
+static uint8_t ledOutputRunning = 0;
+static uint64_t ledOutputStart = 0;
 
-#if 0
+static void lightsSetupDMA(void) {
     // Enable DMA channels for WS2812 control
     DMA.CTRL = DMA_ENABLE_bm | DMA_DBUFMODE_CH01_gc;
 
@@ -113,6 +109,25 @@ void lightsInit(void) {
     DMA.CH1.DESTADDR1 = ((uint16_t)TCF0_CCCBUF & 0xFF00) >> 8;
     DMA.CH1.DESTADDR2 = 0;
 
+    dmaConfigured = 1;
+}
+
+void lightsInit(void) {
+    // Set LED pins as output
+    PORTC.DIRSET = PIN0_bm | PIN1_bm | PIN2_bm | PIN3_bm | PIN4_bm | PIN5_bm;
+    PORTD.DIRSET = PIN0_bm | PIN1_bm | PIN2_bm | PIN3_bm | PIN4_bm | PIN5_bm;
+    PORTE.DIRSET = PIN0_bm | PIN1_bm | PIN2_bm | PIN3_bm | PIN4_bm | PIN5_bm;
+    PORTF.DIRSET = PIN0_bm | PIN1_bm | PIN2_bm | PIN3_bm | PIN4_bm;
+
+    // Disable LEDs on init
+    PORTC.OUTCLR = PIN0_bm | PIN1_bm | PIN2_bm | PIN3_bm | PIN4_bm | PIN5_bm;
+    PORTD.OUTCLR = PIN0_bm | PIN1_bm | PIN2_bm | PIN3_bm | PIN4_bm | PIN5_bm;
+    PORTE.OUTCLR = PIN0_bm | PIN1_bm | PIN2_bm | PIN3_bm | PIN4_bm | PIN5_bm;
+    PORTF.OUTCLR = PIN0_bm | PIN1_bm | PIN2_bm | PIN3_bm | PIN4_bm;
+
+#if 0
+    lightsSetupDMA();
+
     // Trigger DMA transfer on TimerF0 overflow
     EVSYS.CH0MUX = EVSYS_CHMUX_TCF0_OVF_gc;
     EVSYS.CH0CTRL = 0x00;
@@ -152,14 +167,50 @@ void lightsInit(void) {
 
 ISR(TCF0_OVF_vect) { } // bug in DMA hardware?: interrupt needs to exist
 
+uint8_t lightsBusy(void) {
+    return dmaLent || (DMA.STATUS & (DMA_CH0BUSY_bm | DMA_CH1BUSY_bm));
+}
+
+uint8_t lightsLendDMA(void) {
+    uint8_t sreg = SREG;
+    cli();
+    if (lightsBusy()) {
+        SREG = sreg;
+        return 0;
+    }
+    dmaLent = 1;
+    SREG = sreg;
+
+    // CH1 must not be started by the double buffer logic while CH0 is lent
+    DMA.CH0.CTRLA = 0x00;
+    DMA.CH1.CTRLA = 0x00;
+    DMA.CTRL &= ~DMA_DBUFMODE_gm;
+    return 1;
+}
+
+void lightsReturnDMA(void) {
+    DMA.CH0.CTRLA = 0x00;
+    DMA.CH0.CTRLA = DMA_CH_RESET_bm;
+
+    if (dmaConfigured) {
+        lightsSetupDMA();
+    }
+
+    dmaLent = 0;
+
+    if (ledRefresh) {
+        taskReady(TASK_LIGHTS);
+    }
+}
+
 void lightsRGB(uint16_t led, uint32_t color) {
     if (lightsBusy()) {
-        serialWriteString(1, "Error: DMA transfer in progress!\n");
+        serialWriteLiteral(1, "Error: DMA transfer in progress!\n");
         return;
     }
 
     if (led >= LED_COUNT) {
-        serialWriteString(1, "Error: invalid LED number!\n");
+        serialWriteLiteral(1, "Error: invalid LED number!\n");
         return;
     }
 
@@ -189,12 +240,7 @@ static void lightsRGBtoPWM(volatile uint8_t *in, volatile uint8_t *out, uint16_t
     }
 }
 
-void lightsDisplayBuffer(void) {
-    if (lightsBusy()) {
-        serialWriteString(1, "Error: DMA transfer is in progress!\n");
-        return;
-    }
-
+static void lightsOutput(void) {
 //#define TIMER_TEST
 #ifdef TIMER_TEST
     // Timer test - only put out 800kHz 50% PWM signal
@@ -206,7 +252,7 @@ void lightsDisplayBuffer(void) {
     return;
 #endif // TIMER_TEST
 
-    serialWriteString(1, "Starting WS2812 output...\n");
+    serialWriteLiteral(1, "Starting WS2812 output...\n");
 
     // fill both buffers
     lightsRGBtoPWM(ledBuffer, ledBufferA, PWM_BUFFERED_BYTES);
@@ -230,29 +276,46 @@ void lightsDisplayBuffer(void) {
 
     EVSYS.STROBE = 0x01; // strobe our evsys event
 
-#define WAIT_FOR_DMA_TO_FINISH
-#ifdef WAIT_FOR_DMA_TO_FINISH
-    PORTE.OUTCLR = PIN7_bm;
+    // lightsTask() reports when the transfer is done
     if (!lightsBusy()) {
-        serialWriteString(1, "DMA finished immediately?!\n");
+        serialWriteLiteral(1, "DMA finished immediately?!\n");
     } else {
-        uint64_t startTime = getSystemTime();
-        while (lightsBusy());
-        serialWriteString(1, "DMA finished in ");
-        serialWriteInt16(1, getSystemTime() - startTime);
-        serialWriteString(1, "ms!\n");
+        ledOutputStart = getSystemTime();
+        ledOutputRunning = 1;
+    }
+}
+
+void lightsDisplayBuffer(void) {
+    ledRefresh = 1;
+    taskReady(TASK_LIGHTS);
+}
+
+void lightsTask(void) {
+    // runs again when the transfer is done or the channel has been returned
+    if (lightsBusy()) {
+        return;
+    }
+
+    if (ledOutputRunning) {
+        ledOutputRunning = 0;
+        serialWriteLiteral(1, "DMA finished in ");
+        serialWriteInt16(1, getSystemTime() - ledOutputStart);
+        serialWriteLiteral(1, "ms!\n");
+    }
+
+    if (ledRefresh) {
+        ledRefresh = 0;
+        lightsOutput();
     }
-    PORTE.OUTSET = PIN7_bm;
-#endif // WAIT_FOR_DMA_TO_FINISH
 }
 
 static void lightsDMAInterrupt(volatile uint8_t *thisBuf, DMA_CH_t *thisDMA, DMA_CH_t *otherDMA) {
     serialWriteString(1, (thisBuf == ledBufferA) ? "a" : "b");
     if (ledBufferPos > RGB_BUF_SIZE) {
-        serialWriteString(1, "f\n");
+        serialWriteLiteral(1, "f\n");
         goto dma_isr_end;
     } else {
-        serialWriteString(1, "c\n");
+        serialWriteLiteral(1, "c\n");
     }
 
     uint16_t len = PWM_BUFFERED_BYTES;
@@ -288,6 +351,7 @@ dma_isr_end:
     TCF0.CTRLA = 0x00;
     TCF0.CTRLC = 0x00;
 
+    taskReady(TASK_LIGHTS);
     goto dma_isr0;
 }
 
@@ -334,3 +398,15 @@ void lightsSet(uint8_t id, uint8_t state) {
     }
 }
 
+void lightsSetMask(uint32_t on, uint32_t off) {
+    PORTC.OUTCLR = off & 0x1F;
+    PORTD.OUTCLR = (off >> 5) & 0x1F;
+    PORTE.OUTCLR = (off >> 10) & 0x1F;
+    PORTF.OUTCLR = (off >> 15) & 0x1F;
+
+    PORTC.OUTSET = on & 0x1F;
+    PORTD.OUTSET = (on >> 5) & 0x1F;
+    PORTE.OUTSET = (on >> 10) & 0x1F;
+    PORTF.OUTSET = (on >> 15) & 0x1F;
+}
+
@@ -11,11 +11,19 @@
 #include <stdint.h>
 #include <util/delay.h>
 
+#include "config.h"
 #include "clock.h"
 #include "pumps.h"
 #include "lights.h"
 #include "serial.h"
 #include "interface.h"
+#include "idle.h"
+#include "task.h"
+
+// blink heart-beat LED every 500ms
+static void heartbeat(void) {
+    PORTE.OUTTGL = PIN6_bm;
+}
 
 int main(void) {
     // Status LEDs on PE6 and PE7
@@ -27,30 +35,36 @@ int main(void) {
     // Initialize hardware
     initOSCs();
     initSystemTimer();
+    preciseTimeInit();
     pumpsInit();
     lightsInit();
+    idleInit();
 
     // FTDI FT232RL on PC6 (Rx) and PC7 (Tx) / USARTC1 / UART id 1
     PORTC.DIRCLR = PIN6_bm; // Rx as Input
     PORTC.DIRSET = PIN7_bm; // Tx as Output
     PORTC.OUTSET = PIN7_bm; // Set to logic '1'
-    serialInit(1, BAUD(38400, F_CPU));
+    serialInit(1, BAUD(HOST_BAUDRATE, F_CPU));
+    SerialBaud baud;
+    if (serialBaudCalculate(HOST_BAUDRATE, &baud) == 0) {
+        serialSetBaud(1, &baud); // more precise fractional baudrate
+    }
 
     // Enable all interrupt levels
     PMIC.CTRL |= PMIC_LOLVLEN_bm | PMIC_MEDLVLEN_bm | PMIC_HILVLEN_bm;
     sei();
 
     // Print Welcome Message with some version info
-    serialWriteString(1, "\n");
+    serialWriteLiteral(1, "\n");
     interfaceHandler('v', 0);
-    serialWriteString(1, "ready!\n");
+    serialWriteLiteral(1, "ready!\n");
 
     // 4-bit active-low DIP switch for hardware ID on-board
     PORTH.DIRCLR = PIN4_bm | PIN5_bm | PIN6_bm | PIN7_bm;
     uint8_t id = ((~PORTH.IN) & 0xF0) >> 4;
-    serialWriteString(1, "Hardware ID: ");
+    serialWriteLiteral(1, "Hardware ID: ");
     serialWriteInt16(1, id);
-    serialWriteString(1, "\n");
+    serialWriteLiteral(1, "\n");
 
     // Disable LEDs after init
     PORTE.OUTSET = PIN6_bm | PIN7_bm;
@@ -63,17 +77,24 @@ int main(void) {
     lightsDisplayBuffer();
 #endif
 
+    taskRegister(TASK_INTERFACE, "interface", interfaceLoop);
+    taskRegister(TASK_PUMPS, "pumps", pumpsTask);
+    taskRegister(TASK_CLEAN, "clean", pumpsCleanTask);
+    taskRegister(TASK_LIGHTS, "lights", lightsTask);
+    taskRegister(TASK_HEARTBEAT, "heartbeat", heartbeat);
+    taskSchedule(TASK_HEARTBEAT, 500);
+    taskReady(TASK_INTERFACE);
+
     // Main-Loop
-    uint64_t lastBeat = 0;
     for(;;) {
-        // Wait for and handle incoming commands
-        interfaceLoop();
-
-        // blink heart-beat LED every 500ms
-        if ((getSystemTime() - lastBeat) > 500) {
-            lastBeat = getSystemTime();
-            PORTE.OUTTGL = PIN6_bm;
-        }
+        // Run the tasks that have been marked as ready
+        taskLoop();
+
+        // Callbacks of expired deferred timers
+        timerLoop();
+
+        // Sleep until the next interrupt that leaves work for us
+        idleSleep();
     }
 
     return 0; // never reached
@@ -0,0 +1,333 @@
+/*
+ * protocol.c
+ * avr_pump_board
+ *
+ * Binary alternative to the ASCII interface, entered with the 'x' command.
+ * No prompt, no echo and no CR injection.
+ *
+ * Each frame is COBS-encoded and terminated with a 0x00 byte. Decoded, it
+ * contains the opcode, the payload and a CRC16 (XMODEM, little-endian) over
+ * opcode and payload. All multi-byte values are little-endian.
+ *
+ * Every request is answered with exactly one frame:
+ *     reply: [opcode | 0x80] [status] [payload...] [crc16]
+ *     NAK:   [0xFF] [STATUS_CRC_ERROR or STATUS_INVALID_FRAME] [crc16]
+ *
+ * Unsolicited events can be sent between replies:
+ *     event: [0xFE] [STATUS_OK] [event] [slot, unless 0] [crc16]
+ *
+ * Opcodes and payloads:
+ *     VERSION  -                          -> version string
+ *     RECIPE   n * (pump, time32, delay32) -> stored ingredient count
+ *     GO       [align]                    -> - (DONE event when finished)
+ *     LIST     -                          -> n * (pump, time32, delay32)
+ *     PUMP_ON  pump or mask32             -> -
+ *     PUMP_OFF pump or mask32             -> -
+ *     CLEAN    0 or 1 [mask32, on32, pause32, stagger16, cycles16] -> -
+ *              (DONE event when the cleaning sequence has ended)
+ *     ASCII    -                          -> - (back to ASCII interface)
+ *     STATUS   -                          -> mask32, n * (pump, remaining32)
+ *     ABORT    [slot]                     -> - (no slot: all and cleaning)
+ *     BUDGET   [budget16, 20 * weight]    -> budget16, 20 * weight
+ *     SLOT     [slot]                     -> selected slot, running slots mask
+ *
+ * RECIPE, GO and LIST work on the selected recipe slot, 0 after reset.
+ *
+ * Copyright (c) 2017 Thomas Buck <xythobuz@xythobuz.de>
+ * All rights reserved.
+ */
+
+#include <stdint.h>
+
+#include "config.h"
+#include "status.h"
+#include "cobs.h"
+#include "serial.h"
+#include "recipe.h"
+#include "pumps.h"
+#include "protocol.h"
+
+#define INGREDIENT_SIZE 9
+#define CLEAN_CONFIG_SIZE 17
+#define BUDGET_SIZE 22
+
+static uint8_t active = 0;
+
+static uint8_t rxFrame[COBS_ENCODED_SIZE(PROTOCOL_MAX_FRAME)];
+static uint8_t rxLength = 0;
+static uint8_t rxOverflow = 0;
+
+static uint8_t txFrame[PROTOCOL_MAX_FRAME];
+static uint8_t txEncoded[COBS_ENCODED_SIZE(PROTOCOL_MAX_FRAME) + 1];
+
+static uint16_t getWord(const uint8_t *p) {
+    return p[0] | ((uint16_t)p[1] << 8);
+}
+
+static void putWord(uint8_t *p, uint16_t v) {
+    p[0] = v & 0xFF;
+    p[1] = v >> 8;
+}
+
+static uint32_t getLong(const uint8_t *p) {
+    return getWord(p) | ((uint32_t)getWord(p + 2) << 16);
+}
+
+static void putLong(uint8_t *p, uint32_t v) {
+    putWord(p, v & 0xFFFF);
+    putWord(p + 2, v >> 16);
+}
+
+static void sendFrame(uint8_t op, uint8_t status, uint8_t length) {
+    // payload has already been placed at txFrame[2]
+    txFrame[0] = op;
+    txFrame[1] = status;
+    length += 2;
+    putWord(txFrame + length, crc16(txFrame, length));
+    length += 2;
+
+    uint16_t n = cobsEncode(txFrame, length, txEncoded);
+    txEncoded[n++] = 0;
+    serialWriteRaw(1, txEncoded, n);
+}
+
+static uint8_t protocolRecipe(const uint8_t *payload, uint8_t length) {
+    if ((length % INGREDIENT_SIZE) != 0) {
+        return STATUS_INVALID_FRAME;
+    }
+
+    uint8_t count = length / INGREDIENT_SIZE;
+    if (count == 0) {
+        return STATUS_NO_INGREDIENTS;
+    }
+    if (count > RECIPE_MAX_INGREDIENTS) {
+        return STATUS_TOO_MANY_INGREDIENTS;
+    }
+
+    recipeReset();
+    for (uint8_t i = 0; i < count; i++, payload += INGREDIENT_SIZE) {
+        uint8_t status = recipePump(payload[0]);
+        if (status == STATUS_OK) {
+            status = recipeDuration(getLong(payload + 1));
+        }
+        if (status == STATUS_OK) {
+            status = recipeDelay(getLong(payload + 5));
+        }
+        if (status == STATUS_OK) {
+            status = recipeStore();
+        }
+        if (status != STATUS_OK) {
+            recipeReset();
+            return status;
+        }
+    }
+
+    return STATUS_OK;
+}
+
+static uint8_t protocolList(uint8_t *payload) {
+    uint8_t count = recipeCount();
+    for (uint8_t i = 0; i < count; i++, payload += INGREDIENT_SIZE) {
+        const RecipeIngredient *ingredient = recipeIngredient(i);
+        payload[0] = ingredient->pump;
+        putLong(payload + 1, ingredient->time);
+        putLong(payload + 5, ingredient->delay);
+    }
+    return count * INGREDIENT_SIZE;
+}
+
+static uint8_t protocolStatus(uint8_t *payload) {
+    putLong(payload, pumpsRunningMask());
+    uint8_t length = 4;
+    for (uint8_t i = 1; i <= 20; i++) {
+        uint32_t remaining = pumpsRemaining(i);
+        if (remaining > 0) {
+            payload[length] = i;
+            putLong(payload + length + 1, remaining);
+            length += 5;
+        }
+    }
+    return length;
+}
+
+static void protocolHandleFrame(void) {
+    if ((rxLength == 0) && (!rxOverflow)) {
+        // empty frames can be used by the host to resynchronize
+        return;
+    }
+
+    if (rxOverflow) {
+        sendFrame(PROTOCOL_NAK, STATUS_INVALID_FRAME, 0);
+        return;
+    }
+
+    uint8_t length = cobsDecode(rxFrame, rxLength, rxFrame);
+    if ((length < 3) || (length > PROTOCOL_MAX_FRAME)) {
+        sendFrame(PROTOCOL_NAK, STATUS_INVALID_FRAME, 0);
+        return;
+    }
+
+    length -= 2;
+    if (crc16(rxFrame, length) != getWord(rxFrame + length)) {
+        sendFrame(PROTOCOL_NAK, STATUS_CRC_ERROR, 0);
+        return;
+    }
+
+    uint8_t op = rxFrame[0];
+    const uint8_t *payload = rxFrame + 1;
+    length--;
+
+    uint8_t *reply = txFrame + 2;
+    uint8_t replyLength = 0;
+    uint8_t status = STATUS_OK;
+
+    switch (op) {
+        case PROTOCOL_OP_VERSION: {
+            static const char version[] = TARGET_ID " " VERSION_ID;
+            for (replyLength = 0; replyLength < (sizeof(version) - 1); replyLength++) {
+                reply[replyLength] = version[replyLength];
+            }
+            break;
+        }
+
+        case PROTOCOL_OP_RECIPE:
+            status = protocolRecipe(payload, length);
+            reply[0] = recipeCount();
+            replyLength = 1;
+            break;
+
+        case PROTOCOL_OP_GO:
+            if (length == 1) {
+                status = recipeAlign(payload[0]);
+            } else if (length != 0) {
+                status = STATUS_INVALID_FRAME;
+            }
+            if (status == STATUS_OK) {
+                status = recipeGo();
+            }
+            break;
+
+        case PROTOCOL_OP_LIST:
+            replyLength = protocolList(reply);
+            break;
+
+        case PROTOCOL_OP_PUMP_ON:
+        case PROTOCOL_OP_PUMP_OFF:
+            if (length == 4) {
+                // set of pumps, switched at once
+                uint32_t mask = getLong(payload);
+                if (op == PROTOCOL_OP_PUMP_ON) {
+                    status = pumpsSwitch(mask, 0);
+                } else {
+                    status = pumpsSwitch(0, mask);
+                }
+            } else if (length != 1) {
+                status = STATUS_INVALID_FRAME;
+            } else if (op == PROTOCOL_OP_PUMP_ON) {
+                status = pumpOn(payload[0]);
+            } else {
+                status = pumpOff(payload[0]);
+            }
+            break;
+
+        case PROTOCOL_OP_CLEAN:
+            if ((length == CLEAN_CONFIG_SIZE) && payload[0]) {
+                PumpCleanConfig config;
+                config.mask = getLong(payload + 1);
+                config.onTime = getLong(payload + 5);
+                config.pause = getLong(payload + 9);
+                config.stagger = getWord(payload + 13);
+                config.cycles = getWord(payload + 15);
+                status = pumpsCleanStart(&config);
+            } else if ((length != 1) && (length != CLEAN_CONFIG_SIZE)) {
+                status = STATUS_INVALID_FRAME;
+            } else {
+                status = pumpsClean(payload[0] ? 1 : 0);
+            }
+            break;
+
+        case PROTOCOL_OP_ASCII:
+            active = 0;
+            break;
+
+        case PROTOCOL_OP_STATUS:
+            replyLength = protocolStatus(reply);
+            break;
+
+        case PROTOCOL_OP_ABORT:
+            if (length == 1) {
+                status = pumpsAbortSlot(payload[0]);
+            } else if (length != 0) {
+                status = STATUS_INVALID_FRAME;
+            } else {
+                status = pumpsAbort();
+            }
+            break;
+
+        case PROTOCOL_OP_BUDGET:
+            if (length == BUDGET_SIZE) {
+                status = pumpsSetBudget(getWord(payload), payload + 2);
+            } else if (length != 0) {
+                status = STATUS_INVALID_FRAME;
+            }
+            putWord(reply, pumpsBudget());
+            for (uint8_t i = 1; i <= 20; i++) {
+                reply[i + 1] = pumpsWeight(i);
+            }
+            replyLength = BUDGET_SIZE;
+            break;
+
+        case PROTOCOL_OP_SLOT:
+            if (length == 1) {
+                status = recipeSelect(payload[0]);
+            } else if (length != 0) {
+                status = STATUS_INVALID_FRAME;
+            }
+            reply[0] = recipeSelected();
+            reply[1] = pumpsSlots();
+            replyLength = 2;
+            break;
+
+        default:
+            status = STATUS_UNKNOWN_COMMAND;
+            break;
+    }
+
+    sendFrame(op | PROTOCOL_REPLY, status, replyLength);
+}
+
+void protocolStart(void) {
+    active = 1;
+    rxLength = 0;
+    rxOverflow = 0;
+
+    // terminate whatever the host has seen so far
+    uint8_t delimiter = 0;
+    serialWriteRaw(1, &delimiter, 1);
+}
+
+void protocolEvent(uint8_t event, uint8_t slot) {
+    txFrame[2] = event;
+    txFrame[3] = slot;
+    sendFrame(PROTOCOL_EVENT, STATUS_OK, (slot != 0) ? 2 : 1);
+}
+
+uint8_t protocolActive(void) {
+    return active;
+}
+
+void protocolLoop(void) {
+    while (active && serialHasChar(1)) {
+        uint8_t c = serialGet(1);
+        if (c == 0) {
+            protocolHandleFrame();
+            rxLength = 0;
+            rxOverflow = 0;
+        } else if (rxLength < sizeof(rxFrame)) {
+            rxFrame[rxLength++] = c;
+        } else {
+            rxOverflow = 1;
+        }
+    }
+}
+
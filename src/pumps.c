@@ -13,6 +13,19 @@
  * Sense S09 - S16: PK0 - PK7
  * Sense S17 - S20: PQ0 - PQ3
  *
+ * With PUMPS_DMA, recipes are played by TCD0 and DMA channel 0. PORTA,
+ * PORTB and PORTH are mapped to VPORT0 - VPORT2, so their OUT registers
+ * lie in one 9-byte window that is written by a single DMA block on each
+ * timer overflow routed through event channel 1. The overflow interrupt
+ * only prepares the next block and period, the pins switch without any
+ * CPU involvement. Periods longer than PUMP_DMA_MAX_PERIOD are split, the
+ * event is not routed to the DMA for the intermediate overflows.
+ *
+ * The recipes of all slots are merged into this one timeline, each event
+ * records the slots whose recipe ends with it. Starting another recipe
+ * stops the player, rebases the remaining events to the current time,
+ * merges the new ones and plays on from there.
+ *
  * Copyright (c) 2017 Thomas Buck <xythobuz@xythobuz.de>
  * All rights reserved.
  */
@@ -21,30 +34,124 @@
 #include <avr/interrupt.h>
 #include <stdint.h>
 #include <stdlib.h>
-#include <util/delay.h>
 
 //#define DEBUG_PUMPS
 
 #include "config.h"
+#include "status.h"
 #include "serial.h"
 #include "clock.h"
 #include "lights.h"
 #include "pumps.h"
+#include "schedule.h"
+#include "task.h"
 
-static volatile uint8_t pumpRunning = 0;
+// worst case: every pump is turned on and off at a different time. this
+// covers the recipes of all slots, which never share a pump.
+#define PUMP_MAX_EVENTS (2 * 20)
+
+// ms from planning a recipe next to running ones until it starts
+#define PUMP_START_MARGIN 20
 
-static uint16_t pumpLastTime = 0;
-static uint8_t pumpLastIndex = 0;
+typedef struct {
+    uint32_t time; // milliseconds after pumpStartTime
+    uint32_t on; // pumps to turn on, bit (n - 1) for pump n
+    uint32_t off; // pumps to turn off
+    uint8_t done; // bit n: the recipe in slot n has ended
+} PumpEvent;
 
-static RecipeIngredient *pumpLastRecipe = NULL;
-static uint8_t pumpLastRecipeCount = 0;
-static uint16_t pumpCurrentRunTime = 0;
+static volatile uint8_t pumpRunning = 0;
+static volatile uint8_t pumpFinished = PUMPS_FINISHED_NONE;
+static volatile uint32_t pumpMask = 0;
+
+// timeline of the running recipes, sorted by time. the slots use different
+// pumps and each pump is switched twice, so it never holds more events.
+static PumpEvent pumpEvents[PUMP_MAX_EVENTS];
+static uint8_t pumpEventCount = 0;
+static volatile uint8_t pumpEventNext = 0;
+static uint64_t pumpStartTime = 0;
+
+// recipe slots, bit n for slot n
+static volatile uint8_t pumpSlotRunning = 0;
+static volatile uint8_t pumpSlotFinished = 0;
+static uint32_t pumpSlotMask[RECIPE_SLOTS]; // pumps used by each running slot
+
+// current drawn by each pump, in arbitrary units, and the limit for all of them
+static uint8_t pumpWeight[20];
+static uint16_t pumpBudget = PUMP_BUDGET_DEFAULT;
+
+// cleaning sequence, pump i of a cycle is switched on at i * stagger
+static PumpCleanConfig pumpClean;
+static uint8_t pumpCleanOrder[20]; // pump numbers
+static uint8_t pumpCleanCount = 0; // pumps in the sequence, 0 when not cleaning
+static uint8_t pumpCleanOn = 0; // pumps turned on in this cycle
+static uint8_t pumpCleanOff = 0; // pumps turned off again
+static uint16_t pumpCleanCycle = 0;
+static uint64_t pumpCleanStartTime = 0; // of this cycle, ms
+static uint8_t pumpCleanStopping = 0;
+static uint8_t pumpCleanStopFirst = 0; // first pump turned off when stopping
+static uint64_t pumpCleanStopTime = 0;
+
+#ifdef PUMPS_DMA
+
+// 8us timer resolution, longest period 500ms
+#define PUMP_DMA_PRESCALER TC_CLKSEL_DIV256_gc
+#define PUMP_DMA_TICKS_PER_MS (F_CPU / 256ul / 1000ul)
+#define PUMP_DMA_MAX_PERIOD 500
+
+// VPORT0.OUT up to VPORT2.OUT: OUT, IN, INTFLAGS, DIR, OUT, IN, INTFLAGS, DIR, OUT
+#define PUMP_DMA_BLOCK 9
+
+static volatile uint8_t pumpDmaBlock[PUMP_DMA_BLOCK];
+static volatile uint8_t pumpDmaActive = 0;
+static uint8_t pumpDmaLent = 0; // channel still has to be returned when inactive
+static uint8_t pumpDmaFires = 0; // current period ends with pumpEventNext
+static uint8_t pumpDmaNextFires = 0; // same for the period in PERBUF
+static uint8_t pumpDmaEvent = 0; // event the next periods lead up to
+static uint32_t pumpDmaLeft = 0; // ms before that event not scheduled yet
+
+#endif // PUMPS_DMA
 
 uint8_t pumpsDispensing(void) {
     return pumpRunning;
 }
 
+uint8_t pumpsFinished(uint8_t *slot) {
+    uint8_t sreg = SREG;
+    cli();
+    uint8_t finished = pumpFinished;
+    pumpFinished = PUMPS_FINISHED_NONE;
+    if ((finished == PUMPS_FINISHED_NONE) && pumpSlotFinished) {
+        uint8_t n = 0;
+        while (!(pumpSlotFinished & (1 << n))) {
+            n++;
+        }
+        pumpSlotFinished &= ~(1 << n);
+        *slot = n;
+        finished = PUMPS_FINISHED_RECIPE;
+    }
+    SREG = sreg;
+    return finished;
+}
+
+uint8_t pumpsSlots(void) {
+    return pumpSlotRunning;
+}
+
+uint32_t pumpsRunningMask(void) {
+    uint8_t sreg = SREG;
+    cli();
+    uint32_t mask = pumpMask;
+    SREG = sreg;
+    return mask;
+}
+
 void pumpsInit(void) {
+    for (uint8_t i = 0; i < 20; i++) {
+        pumpWeight[i] = PUMP_WEIGHT_DEFAULT;
+    }
+    pumpBudget = PUMP_BUDGET_DEFAULT;
+
     // All pump pins as output
     PORTA.DIRSET = 0xFF;
     PORTB.DIRSET = 0xFF;
@@ -55,12 +162,20 @@ void pumpsInit(void) {
     PORTB.OUTCLR = 0xFF;
     PORTH.OUTCLR = PIN0_bm | PIN1_bm | PIN2_bm | PIN3_bm;
 
+#ifdef PUMPS_DMA
+    // VPORT0 and VPORT1 are PORTA and PORTB after reset
+    PORTCFG.VPCTRLA = PORTCFG_VP0MAP_PORTA_gc | PORTCFG_VP1MAP_PORTB_gc;
+    PORTCFG.VPCTRLB = (PORTCFG.VPCTRLB & PORTCFG_VP3MAP_gm) | PORTCFG_VP2MAP_PORTH_gc;
+    pumpDmaActive = 0;
+#endif // PUMPS_DMA
+
     pumpRunning = 0;
-    pumpLastTime = 0;
-    pumpLastIndex = 0;
-    pumpLastRecipe = NULL;
-    pumpLastRecipeCount = 0;
-    pumpCurrentRunTime = 0;
+    pumpFinished = PUMPS_FINISHED_NONE;
+    pumpMask = 0;
+    pumpEventCount = 0;
+    pumpEventNext = 0;
+    pumpSlotRunning = 0;
+    pumpSlotFinished = 0;
 
     // All sense pins as input
     PORTJ.DIRSET = 0x00;
@@ -81,53 +196,78 @@ void pumpsInit(void) {
     */
 }
 
-static void pumpSet(uint8_t id, uint8_t state) {
-    if ((id < 1) || (id > 20)) {
-        serialWriteString(1, "Error: invalid pump id!\n");
-        return;
+#ifdef PUMPS_DMA
+
+// Port state after the next event, must be called with interrupts disabled
+static void pumpDmaStage(void) {
+    const PumpEvent *event = &pumpEvents[pumpEventNext];
+    uint32_t state = (pumpMask & ~event->off) | event->on;
+
+    pumpDmaBlock[0] = state & 0xFF;
+    pumpDmaBlock[1] = 0x00; // IN is read-only
+    pumpDmaBlock[2] = 0x00; // writing zero clears no flags
+    pumpDmaBlock[3] = VPORT1.DIR;
+    pumpDmaBlock[4] = (state >> 8) & 0xFF;
+    pumpDmaBlock[5] = 0x00;
+    pumpDmaBlock[6] = 0x00;
+    pumpDmaBlock[7] = VPORT2.DIR;
+    pumpDmaBlock[8] = (VPORT2.OUT & 0xF0) | ((state >> 16) & 0x0F);
+}
+
+#endif // PUMPS_DMA
+
+// Bytes 0, 1 and 2 of the masks belong to PORTA, PORTB and PORTH
+uint8_t pumpsSwitch(uint32_t on, uint32_t off) {
+    if ((on | off) & ~PUMPS_ALL_MASK) {
+        return STATUS_INVALID_PUMP;
     }
-    id--;
 
-    if (id < 8) {
-        if (state) {
-            PORTA.OUTSET = (1 << id);
-        } else {
-            PORTA.OUTCLR = (1 << id);
-        }
-    } else if (id < 16) {
-        if (state) {
-            PORTB.OUTSET = (1 << (id - 8));
-        } else {
-            PORTB.OUTCLR = (1 << (id - 8));
-        }
-    } else {
-        if (state) {
-            PORTH.OUTSET = (1 << (id - 16));
-        } else {
-            PORTH.OUTCLR = (1 << (id - 16));
-        }
+    uint8_t sreg = SREG;
+    cli();
+
+    pumpMask = (pumpMask & ~off) | on;
+
+#ifdef PUMPS_DMA
+    // the prepared block would otherwise undo this change
+    if (pumpDmaActive) {
+        pumpDmaStage();
     }
+#endif // PUMPS_DMA
 
-    lightsSet(id, state);
+    PORTA.OUTCLR = off & 0xFF;
+    PORTB.OUTCLR = (off >> 8) & 0xFF;
+    PORTH.OUTCLR = (off >> 16) & 0x0F;
+
+    PORTA.OUTSET = on & 0xFF;
+    PORTB.OUTSET = (on >> 8) & 0xFF;
+    PORTH.OUTSET = (on >> 16) & 0x0F;
+    SREG = sreg;
+
+    lightsSetMask(on, off);
+    return STATUS_OK;
 }
 
-void pumpOn(uint16_t arg) {
-	pumpSet(arg, 1);
+uint8_t pumpOn(uint32_t id) {
+	if ((id < 1) || (id > 20)) {
+		return STATUS_INVALID_PUMP;
+	}
+	return pumpsSwitch(PUMP_MASK(id), 0);
 }
 
-void pumpOff(uint16_t arg) {
-	pumpSet(arg, 0);
+uint8_t pumpOff(uint32_t id) {
+	if ((id < 1) || (id > 20)) {
+		return STATUS_INVALID_PUMP;
+	}
+	return pumpsSwitch(0, PUMP_MASK(id));
 }
 
 static void pumpErrorInterrupt(uint8_t n) {
-    serialWriteString(1, "Error: pump driver port ");
+    serialWriteLiteral(1, "Error: pump driver port ");
     serialWriteInt16(1, n);
-    serialWriteString(1, " reports a problem!\n");
+    serialWriteLiteral(1, " reports a problem!\n");
 
     // turn off all pumps when an error is reported
-    for (uint8_t i = 1; i <= 20; i++) {
-        pumpSet(i, 0);
-    }
+    pumpsSwitch(0, PUMPS_ALL_MASK);
 
     pumpRunning = 0;
 }
@@ -144,139 +284,701 @@ ISR(PORTQ_INT0_vect) {
     pumpErrorInterrupt(2);
 }
 
-void pumpsClean(uint8_t state) {
-    if (state && pumpRunning) {
-        serialWriteString(1, "Error: can't clean while pumps are running!\n");
-        return;
+static uint64_t pumpCleanOnTime(uint8_t i) {
+    return pumpCleanStartTime + ((uint32_t)i * pumpClean.stagger);
+}
+
+static uint64_t pumpCleanOffTime(uint8_t i) {
+    if (pumpCleanStopping) {
+        return pumpCleanStopTime + ((uint32_t)(i - pumpCleanStopFirst) * pumpClean.stagger);
     }
+    return pumpCleanOnTime(i) + pumpClean.onTime;
+}
+
+// pumps only turn off by themselves when they have an on-time
+static uint8_t pumpCleanTurnsOff(void) {
+    return pumpCleanStopping || (pumpClean.onTime != 0);
+}
 
-    if ((!state) && (!pumpRunning)) {
-        serialWriteString(1, "Error: can't stop cleaning while no pumps are running!\n");
+// Clean task, switches the pumps that are due and waits for the next one.
+// One pump after another keeps the inrush current low.
+void pumpsCleanTask(void) {
+    if (pumpCleanCount == 0) {
         return;
     }
 
-    pumpRunning = state ? 1 : 0;
+    uint64_t now = getSystemTime();
+    uint32_t on = 0, off = 0;
+    while ((!pumpCleanStopping) && (pumpCleanOn < pumpCleanCount)
+            && (pumpCleanOnTime(pumpCleanOn) <= now)) {
+        on |= PUMP_MASK(pumpCleanOrder[pumpCleanOn++]);
+    }
+    while (pumpCleanTurnsOff() && (pumpCleanOff < pumpCleanOn)
+            && (pumpCleanOffTime(pumpCleanOff) <= now)) {
+        off |= PUMP_MASK(pumpCleanOrder[pumpCleanOff++]);
+    }
+
+    // both due at once when we're late, these just stay off
+    uint32_t both = on & off;
+    if (on | off) {
+        pumpsSwitch(on & ~both, off & ~both);
+    }
+
+    if ((pumpCleanOff == pumpCleanOn)
+            && (pumpCleanStopping || (pumpCleanOn == pumpCleanCount))) {
+        pumpCleanCycle++;
+        if (pumpCleanStopping || (pumpCleanCycle >= pumpClean.cycles)) {
+            pumpCleanCount = 0;
+            taskSchedule(TASK_CLEAN, 0);
+            pumpRunning = 0;
+            pumpFinished = PUMPS_FINISHED_CLEAN;
+            taskReady(TASK_INTERFACE);
+            return;
+        }
+
+        // counted from the last pump turned off, so the cycles don't drift
+        pumpCleanStartTime = pumpCleanOffTime(pumpCleanCount - 1) + pumpClean.pause;
+        pumpCleanOn = 0;
+        pumpCleanOff = 0;
+    }
+
+    uint64_t next = 0;
+    if ((!pumpCleanStopping) && (pumpCleanOn < pumpCleanCount)) {
+        next = pumpCleanOnTime(pumpCleanOn);
+    }
+    if (pumpCleanTurnsOff() && (pumpCleanOff < pumpCleanOn)
+            && ((next == 0) || (pumpCleanOffTime(pumpCleanOff) < next))) {
+        next = pumpCleanOffTime(pumpCleanOff);
+    }
+
+    if (next == 0) {
+        // all pumps are running until stopped
+        taskSchedule(TASK_CLEAN, 0);
+    } else if (next <= now) {
+        taskSchedule(TASK_CLEAN, 0);
+        taskReady(TASK_CLEAN);
+    } else {
+        taskSchedule(TASK_CLEAN, next - now);
+    }
+}
+
+uint8_t pumpsCleanStart(const PumpCleanConfig *config) {
+    if (pumpRunning) {
+        return STATUS_PUMPS_RUNNING;
+    }
+
+    if ((config->mask == 0) || (config->mask & ~PUMPS_ALL_MASK)) {
+        return STATUS_INVALID_PUMP;
+    }
+
+    if (config->cycles == 0) {
+        return STATUS_INVALID_PARAMETER;
+    }
 
+    pumpClean = *config;
+    pumpCleanCount = 0;
     for (uint8_t i = 1; i <= 20; i++) {
-        pumpSet(i, state);
-        _delay_ms(PUMP_CLEAN_DELAY);
+        if (pumpClean.mask & PUMP_MASK(i)) {
+            pumpCleanOrder[pumpCleanCount++] = i;
+        }
     }
+
+    pumpCleanOn = 0;
+    pumpCleanOff = 0;
+    pumpCleanCycle = 0;
+    pumpCleanStopping = 0;
+    pumpCleanStartTime = getSystemTime();
+    pumpRunning = 1;
+    pumpFinished = PUMPS_FINISHED_NONE;
+    pumpsCleanTask();
+
+    return STATUS_OK;
 }
 
-static void pumpHandleRecipeState(void) {
-    // turn off the current pump
-    pumpSet(pumpLastRecipe[pumpLastIndex].pump, 0);
-    pumpCurrentRunTime = pumpLastRecipe[pumpLastIndex].time;
-    pumpLastRecipe[pumpLastIndex].time = 0;
+uint8_t pumpsCleanStop(void) {
+    if (pumpCleanCount == 0) {
+        return STATUS_PUMPS_IDLE;
+    }
 
-#ifdef DEBUG_PUMPS
-    serialWriteString(1, "Debug: turning off pump ");
-    serialWriteInt16(1, pumpLastRecipe[pumpLastIndex].pump);
-    serialWriteString(1, "\n");
-#endif // DEBUG_PUMPS
+    // the pumps that are still running are turned off in the same order
+    pumpCleanStopping = 1;
+    pumpCleanStopFirst = pumpCleanOff;
+    pumpCleanStopTime = getSystemTime();
+    pumpsCleanTask();
 
-    // determine next pump
-    pumpLastTime = 0xFFFF;
-    pumpLastIndex = RECIPE_MAX_INGREDIENTS;
-    for (uint8_t i = 0; i < pumpLastRecipeCount; i++) {
-        if (pumpLastRecipe[i].time > 0) {
-            // turn off other pumps with the same timestamp
-            if (pumpLastRecipe[i].time <= pumpCurrentRunTime) {
-                pumpSet(pumpLastRecipe[i].pump, 0);
+    return STATUS_OK;
+}
 
-#ifdef DEBUG_PUMPS
-                serialWriteString(1, "Debug: also turning off pump ");
-                serialWriteInt16(1, pumpLastRecipe[i].pump);
-                serialWriteString(1, "\n");
-#endif // DEBUG_PUMPS
+uint8_t pumpsClean(uint8_t state) {
+    if (state) {
+        PumpCleanConfig config = PUMP_CLEAN_DEFAULTS;
+        return pumpsCleanStart(&config);
+    } else {
+        return pumpsCleanStop();
+    }
+}
+
+uint8_t pumpsCleanProgress(PumpCleanProgress *progress) {
+    if (pumpCleanCount == 0) {
+        return 0;
+    }
+
+    progress->cycle = pumpCleanCycle + 1;
+    progress->cycles = pumpClean.cycles;
+    progress->pumps = pumpCleanStopping ? pumpCleanOn : pumpCleanCount;
+    progress->done = pumpCleanOff;
+    progress->stopping = pumpCleanStopping;
+    return 1;
+}
 
-                pumpLastRecipe[i].time = 0;
-            } else if (pumpLastRecipe[i].time < pumpLastTime) {
-                pumpLastTime = pumpLastRecipe[i].time;
-                pumpLastIndex = i;
+uint32_t pumpsRemaining(uint8_t pump) {
+    if ((pump < 1) || (pump > 20)) {
+        return 0;
+    }
+
+    uint32_t bit = PUMP_MASK(pump);
+    uint32_t remaining = 0;
+
+    uint8_t sreg = SREG;
+    cli();
+    if (pumpRunning) {
+        uint32_t elapsed = getSystemTime() - pumpStartTime;
+        for (uint8_t i = pumpEventNext; i < pumpEventCount; i++) {
+            if (pumpEvents[i].off & bit) {
+                // the event may be due, but not yet played
+                if (pumpEvents[i].time > elapsed) {
+                    remaining = pumpEvents[i].time - elapsed;
+                }
+                break;
+            }
+        }
+    }
+    SREG = sreg;
+
+    if ((pumpCleanCount > 0) && pumpCleanTurnsOff()) {
+        uint64_t now = getSystemTime();
+        uint8_t last = pumpCleanStopping ? pumpCleanOn : pumpCleanCount;
+        for (uint8_t i = pumpCleanOff; i < last; i++) {
+            if ((pumpCleanOrder[i] == pump) && (pumpCleanOffTime(i) > now)) {
+                remaining = pumpCleanOffTime(i) - now;
             }
         }
     }
 
-    // set up timer for next pump
-    if (pumpLastIndex < RECIPE_MAX_INGREDIENTS) {
-#ifdef DEBUG_PUMPS
-        serialWriteString(1, "Debug: next pump to turn off: ");
-        serialWriteInt16(1, pumpLastRecipe[pumpLastIndex].pump);
-        serialWriteString(1, " in ");
-        serialWriteInt16(1, pumpLastRecipe[pumpLastIndex].time - pumpCurrentRunTime);
-        serialWriteString(1, "\n");
-#endif // DEBUG_PUMPS
+    return remaining;
+}
 
-        quickTimeFireIn(pumpLastRecipe[pumpLastIndex].time - pumpCurrentRunTime, pumpHandleRecipeState);
-    } else {
+// Insert into a sorted timeline, merging events with the same time
+static void pumpAddEvent(PumpEvent *events, uint8_t *count, uint32_t time, uint32_t on, uint32_t off) {
+    uint8_t i = *count;
+    while ((i > 0) && (events[i - 1].time > time)) {
+        i--;
+    }
+
+    if ((i > 0) && (events[i - 1].time == time)) {
+        events[i - 1].on |= on;
+        events[i - 1].off |= off;
+        return;
+    }
+
+    for (uint8_t j = *count; j > i; j--) {
+        events[j] = events[j - 1];
+    }
+    events[i].time = time;
+    events[i].on = on;
+    events[i].off = off;
+    events[i].done = 0;
+    (*count)++;
+}
+
+// Bookkeeping for an event that has just been applied
+static void pumpEventPlayed(const PumpEvent *event) {
+    if (event->done) {
+        pumpSlotRunning &= ~event->done;
+        pumpSlotFinished |= event->done;
+        taskReady(TASK_PUMPS);
+    }
+
+    if (pumpEventNext >= pumpEventCount) {
         pumpRunning = 0;
+        taskReady(TASK_PUMPS);
+        PORTE.OUTSET = PIN7_bm;
+    }
+}
 
-#ifdef DEBUG_PUMPS
-        serialWriteString(1, "Debug: Done!\n");
-#endif // DEBUG_PUMPS
+// Called from the one-shot ISR, applies one event and schedules the next one
+static void pumpHandleEvent(void) {
+    const PumpEvent *event = &pumpEvents[pumpEventNext++];
+    pumpsSwitch(event->on, event->off);
+    pumpEventPlayed(event);
+
+    if (pumpEventNext < pumpEventCount) {
+        preciseTimeFireIn(pumpEvents[pumpEventNext].time - event->time, 0, pumpHandleEvent);
     }
 }
 
-void pumpsRecipe(RecipeIngredient *recipe, uint8_t ingredients) {
-    if (pumpRunning) {
-        serialWriteString(1, "Error: can't dispense recipe while pumps are running!\n");
+#ifdef PUMPS_DMA
+
+// Returns the next timer period and sets pumpDmaNextFires
+static uint16_t pumpDmaSchedule(void) {
+    uint32_t ms = pumpDmaLeft;
+    if (ms > PUMP_DMA_MAX_PERIOD) {
+        ms = PUMP_DMA_MAX_PERIOD;
+        pumpDmaLeft -= ms;
+        pumpDmaNextFires = 0;
+    } else {
+        pumpDmaNextFires = 1;
+        pumpDmaEvent++;
+        if (pumpDmaEvent < pumpEventCount) {
+            pumpDmaLeft = pumpEvents[pumpDmaEvent].time - pumpEvents[pumpDmaEvent - 1].time;
+        }
+    }
+    return (ms * PUMP_DMA_TICKS_PER_MS) - 1;
+}
+
+static void pumpDmaStop(void) {
+    TCD0.CTRLA = TC_CLKSEL_OFF_gc;
+    TCD0.INTCTRLA = TC_OVFINTLVL_OFF_gc;
+    EVSYS.CH1MUX = EVSYS_CHMUX_OFF_gc;
+    DMA.CH0.CTRLA &= ~DMA_CH_ENABLE_bm;
+    pumpDmaActive = 0;
+}
+
+// Reconfiguring the lights DMA takes a while, so this is not done in the ISR
+static void pumpDmaRelease(void) {
+    if (pumpDmaLent && !pumpDmaActive) {
+        pumpDmaLent = 0;
+        lightsReturnDMA();
+    }
+}
+
+// Must be called with interrupts disabled, after the events that are due
+// elapsed ms into the timeline have been applied. Returns 0 if the DMA
+// channel is busy.
+static uint8_t pumpDmaStart(uint32_t elapsed) {
+    // still lent when restarted for another recipe
+    if ((!pumpDmaLent) && (!lightsLendDMA())) {
+        return 0;
+    }
+
+    pumpDmaLent = 1;
+    pumpDmaActive = 1;
+    pumpDmaStage();
+
+    DMA.CTRL |= DMA_ENABLE_bm;
+
+    // one block from our buffer to the VPORT window on every trigger
+    DMA.CH0.ADDRCTRL = DMA_CH_SRCRELOAD_BLOCK_gc | DMA_CH_SRCDIR_INC_gc
+            | DMA_CH_DESTRELOAD_BLOCK_gc | DMA_CH_DESTDIR_INC_gc;
+    DMA.CH0.TRIGSRC = DMA_CH_TRIGSRC_EVSYS_CH1_gc;
+    DMA.CH0.TRFCNT = PUMP_DMA_BLOCK;
+    DMA.CH0.REPCNT = 0x00; // until we disable the channel
+    DMA.CH0.SRCADDR0 = ((uint16_t)pumpDmaBlock & 0x00FF);
+    DMA.CH0.SRCADDR1 = ((uint16_t)pumpDmaBlock & 0xFF00) >> 8;
+    DMA.CH0.SRCADDR2 = 0x00;
+    DMA.CH0.DESTADDR0 = ((uint16_t)&VPORT0.OUT & 0x00FF);
+    DMA.CH0.DESTADDR1 = ((uint16_t)&VPORT0.OUT & 0xFF00) >> 8;
+    DMA.CH0.DESTADDR2 = 0x00;
+    DMA.CH0.CTRLB = 0x00;
+
+    // no single-shot: each trigger transfers the whole block
+    DMA.CH0.CTRLA = DMA_CH_ENABLE_bm | DMA_CH_REPEAT_bm | DMA_CH_BURSTLEN_1BYTE_gc;
+
+    EVSYS.CH1CTRL = 0x00;
+
+    TCD0.CTRLA = TC_CLKSEL_OFF_gc;
+    TCD0.CTRLB = TC_WGMODE_NORMAL_gc;
+    TCD0.CNT = 0;
+
+    pumpDmaEvent = pumpEventNext;
+    pumpDmaLeft = pumpEvents[pumpDmaEvent].time - elapsed;
+
+    TCD0.PER = pumpDmaSchedule();
+    pumpDmaFires = pumpDmaNextFires;
+    if (pumpDmaEvent < pumpEventCount) {
+        TCD0.PERBUF = pumpDmaSchedule();
+    }
+    EVSYS.CH1MUX = pumpDmaFires ? EVSYS_CHMUX_TCD0_OVF_gc : EVSYS_CHMUX_OFF_gc;
+
+    TCD0.INTFLAGS = TC0_OVFIF_bm;
+    TCD0.INTCTRLA = TC_OVFINTLVL_LO_gc;
+    TCD0.CTRLA = PUMP_DMA_PRESCALER;
+    return 1;
+}
+
+// The DMA has already written the ports when this runs, so it only has to
+// keep the bookkeeping in sync and prepare the period after the next one.
+ISR(TCD0_OVF_vect) {
+    if (pumpDmaFires) {
+        const PumpEvent *event = &pumpEvents[pumpEventNext++];
+        pumpMask = (pumpMask & ~event->off) | event->on;
+        lightsSetMask(event->on, event->off);
+        pumpEventPlayed(event);
+
+        if (pumpEventNext >= pumpEventCount) {
+            pumpDmaStop();
+            return;
+        }
+
+        pumpDmaStage();
+    }
+
+    // PER has just been loaded from PERBUF
+    pumpDmaFires = pumpDmaNextFires;
+    EVSYS.CH1MUX = pumpDmaFires ? EVSYS_CHMUX_TCD0_OVF_gc : EVSYS_CHMUX_OFF_gc;
+
+    if (pumpDmaEvent < pumpEventCount) {
+        TCD0.PERBUF = pumpDmaSchedule();
+    } else {
+        pumpDmaNextFires = 0;
+    }
+}
+
+#endif // PUMPS_DMA
+
+// Must be called with interrupts disabled. Pins already switched stay as they are.
+static void pumpStop(void) {
+#ifdef PUMPS_DMA
+    if (pumpDmaActive) {
+        pumpDmaStop();
+    }
+#endif // PUMPS_DMA
+    preciseTimeCancel();
+}
+
+// Must be called with interrupts disabled and the player stopped. Applies
+// the events due elapsed ms after pumpStartTime and plays the others.
+static void pumpPlay(uint32_t elapsed) {
+    while ((pumpEventNext < pumpEventCount) && (pumpEvents[pumpEventNext].time <= elapsed)) {
+        const PumpEvent *event = &pumpEvents[pumpEventNext++];
+        pumpsSwitch(event->on, event->off);
+        pumpEventPlayed(event);
+    }
+
+    if (pumpEventNext >= pumpEventCount) {
         return;
     }
 
-    if (ingredients < 1) {
-        serialWriteString(1, "Error: can't dispense empty recipe!\n");
+#ifdef PUMPS_DMA
+    if (pumpDmaStart(elapsed)) {
         return;
     }
+    // channel is busy, fall back to the TCE0 one-shot timer
+#endif // PUMPS_DMA
+    preciseTimeFireIn(pumpEvents[pumpEventNext].time - elapsed, 0, pumpHandleEvent);
+}
 
-    pumpLastRecipe = recipe;
-    pumpLastRecipeCount = ingredients;
-    pumpLastTime = 0xFFFF;
-    pumpLastIndex = RECIPE_MAX_INGREDIENTS;
-    for (uint8_t i = 0; i < ingredients; i++) {
-        if ((recipe[i].pump < 1) || (recipe[i].pump > 20)) {
-            serialWriteString(1, "Error: invalid pump in recipe!\n");
-            return;
+// Must be called with interrupts disabled. The remaining events are moved
+// to the front and made relative to shift ms after pumpStartTime, then the
+// sorted events are merged into them, delayed by offset ms.
+static void pumpMergeEvents(uint32_t shift, uint32_t offset, PumpEvent *events, uint8_t count) {
+    uint8_t n = 0;
+    for (uint8_t i = pumpEventNext; i < pumpEventCount; i++, n++) {
+        pumpEvents[n] = pumpEvents[i];
+        pumpEvents[n].time = (pumpEvents[n].time > shift) ? (pumpEvents[n].time - shift) : 0;
+    }
+
+    for (uint8_t j = 0; j < count; j++) {
+        events[j].time += offset;
+    }
+
+    // from the back, so nothing is overwritten before it has been moved
+    uint8_t i = n, j = count, k = n + count;
+    while (j > 0) {
+        if ((i > 0) && (pumpEvents[i - 1].time > events[j - 1].time)) {
+            pumpEvents[--k] = pumpEvents[--i];
+        } else if ((i > 0) && (pumpEvents[i - 1].time == events[j - 1].time)) {
+            j--;
+            pumpEvents[--k] = pumpEvents[--i];
+            pumpEvents[k].on |= events[j].on;
+            pumpEvents[k].off |= events[j].off;
+            pumpEvents[k].done |= events[j].done;
+        } else {
+            pumpEvents[--k] = events[--j];
         }
-        if (recipe[i].time < 1) {
-            serialWriteString(1, "Error: invalid time in recipe!\n");
-            return;
+    }
+
+    // merged events leave a gap in front of the moved ones
+    uint8_t gap = k - i;
+    for (uint8_t m = k; m < (n + count); m++) {
+        pumpEvents[m - gap] = pumpEvents[m];
+    }
+    pumpEventCount = n + count - gap;
+    pumpEventNext = 0;
+}
+
+static uint16_t pumpWeightOf(uint32_t mask) {
+    uint16_t weight = 0;
+    for (uint8_t i = 0; i < 20; i++) {
+        if (mask & PUMP_MASK(i + 1)) {
+            weight += pumpWeight[i];
         }
+    }
+    return weight;
+}
+
+// Pump task, finishes recipes after the interrupts have played them
+void pumpsTask(void) {
+#ifdef PUMPS_DMA
+    pumpDmaRelease();
+#endif // PUMPS_DMA
 
-		// select the pump with the lowest duration as the one we turn off
-		// first, on our next "interrupt"
-        if ((recipe[i].time + recipe[i].delay) < pumpLastTime) {
-            pumpLastTime = recipe[i].time + recipe[i].delay;
-            pumpLastIndex = i;
+    if (pumpFinished || pumpSlotFinished) {
+        taskReady(TASK_INTERFACE);
+    }
+}
+
+uint8_t pumpsSetBudget(uint16_t budget, const uint8_t *weight) {
+    if (weight == NULL) {
+        weight = pumpWeight;
+    }
+
+    for (uint8_t i = 0; i < 20; i++) {
+        if (weight[i] > budget) {
+            return STATUS_INVALID_PARAMETER;
         }
     }
 
-	// TODO add support for delay, currently all are turned on at the same time!!
+    for (uint8_t i = 0; i < 20; i++) {
+        pumpWeight[i] = weight[i];
+    }
+    pumpBudget = budget;
+    return STATUS_OK;
+}
+
+uint16_t pumpsBudget(void) {
+    return pumpBudget;
+}
 
-    if (pumpLastIndex >= RECIPE_MAX_INGREDIENTS) {
-        serialWriteString(1, "Error: no valid next pump found!\n");
-        return;
+uint8_t pumpsWeight(uint8_t pump) {
+    if ((pump < 1) || (pump > 20)) {
+        return 0;
     }
+    return pumpWeight[pump - 1];
+}
 
-    pumpCurrentRunTime = 0;
+uint8_t pumpsAbort(void) {
+    if (!pumpRunning) {
+        return STATUS_PUMPS_IDLE;
+    }
 
-    // initialize our timer used for this
-    quickTimeInit();
+    // no timer callback may run in between
+    uint8_t sreg = SREG;
+    cli();
+    pumpStop();
+#ifdef PUMPS_DMA
+    pumpDmaRelease();
+#endif // PUMPS_DMA
+    taskSchedule(TASK_CLEAN, 0);
+    pumpCleanCount = 0;
+    pumpsSwitch(0, PUMPS_ALL_MASK);
+    pumpEventNext = pumpEventCount;
+    pumpSlotRunning = 0;
+    pumpRunning = 0;
+    SREG = sreg;
 
-    pumpRunning = 1;
+    PORTE.OUTSET = PIN7_bm;
+    return STATUS_OK;
+}
+
+uint8_t pumpsAbortSlot(uint8_t slot) {
+    if (slot >= RECIPE_SLOTS) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    uint8_t bit = 1 << slot;
+    uint8_t sreg = SREG;
+    cli();
+    if (!(pumpSlotRunning & bit)) {
+        SREG = sreg;
+        return STATUS_PUMPS_IDLE;
+    }
+
+    // drop the pumps of this slot from the timeline, the others play on
+    pumpStop();
+    uint32_t mask = pumpSlotMask[slot];
+    uint8_t n = pumpEventNext;
+    for (uint8_t i = pumpEventNext; i < pumpEventCount; i++) {
+        PumpEvent event = pumpEvents[i];
+        event.on &= ~mask;
+        event.off &= ~mask;
+        event.done &= ~bit;
+        if (event.on || event.off || event.done) {
+            pumpEvents[n++] = event;
+        }
+    }
+    pumpEventCount = n;
+    pumpSlotRunning &= ~bit;
+    pumpsSwitch(0, mask);
 
+    if (pumpEventNext < pumpEventCount) {
+        pumpPlay(getSystemTime() - pumpStartTime);
+    } else {
+        pumpRunning = 0;
+        taskReady(TASK_PUMPS);
+        PORTE.OUTSET = PIN7_bm;
+    }
+    SREG = sreg;
+
+    return STATUS_OK;
+}
+
+// pumps used by the recipes that are running
+static uint32_t pumpSlotPumps(void) {
+    uint32_t mask = 0;
+    for (uint8_t i = 0; i < RECIPE_SLOTS; i++) {
+        if (pumpSlotRunning & (1 << i)) {
+            mask |= pumpSlotMask[i];
+        }
+    }
+    return mask;
+}
+
+// Power drawn by the running recipes from begin (ms since reset) on. The
+// remaining timeline is copied to events first. Returns the number of
+// load entries, 0 if no recipe is running.
+static uint8_t pumpLoad(uint64_t begin, PumpEvent *events, ScheduleLoad *load) {
+    uint8_t sreg = SREG;
+    cli();
+    uint32_t state = pumpMask & pumpSlotPumps();
+    uint32_t shift = begin - pumpStartTime;
+    uint8_t count = 0;
+    for (uint8_t i = pumpEventNext; i < pumpEventCount; i++) {
+        events[count++] = pumpEvents[i];
+    }
+    SREG = sreg;
+
+    if (count == 0) {
+        return 0;
+    }
+
+    // events before begin only change the level at its start
+    load[0].time = 0;
+    load[0].level = pumpWeightOf(state);
+    uint8_t loads = 1;
+    for (uint8_t i = 0; i < count; i++) {
+        uint32_t time = (events[i].time > shift) ? (events[i].time - shift) : 0;
+        state = (state & ~events[i].off) | events[i].on;
+        if (time != load[loads - 1].time) {
+            load[loads++].time = time;
+        }
+        load[loads - 1].level = pumpWeightOf(state);
+    }
+    return loads;
+}
+
+uint8_t pumpsRecipe(uint8_t slot, const RecipeIngredient *recipe, uint8_t ingredients,
+        uint8_t align) {
+    if (slot >= RECIPE_SLOTS) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    uint8_t bit = 1 << slot;
+    if ((pumpCleanCount > 0) || (pumpSlotRunning & bit)) {
+        return STATUS_PUMPS_RUNNING;
+    }
+
+    if (ingredients < 1) {
+        return STATUS_NO_INGREDIENTS;
+    }
+
+    if (ingredients > RECIPE_MAX_INGREDIENTS) {
+        return STATUS_TOO_MANY_INGREDIENTS;
+    }
+
+    uint32_t mask = 0;
+    for (uint8_t i = 0; i < ingredients; i++) {
+        if ((recipe[i].pump < 1) || (recipe[i].pump > 20)
+                || (mask & PUMP_MASK(recipe[i].pump))) {
+            return STATUS_INVALID_PUMP;
+        }
+        if ((recipe[i].time < 1) || (recipe[i].delay > (0xFFFFFFFF - recipe[i].time))) {
+            return STATUS_INVALID_TIME;
+        }
+        mask |= PUMP_MASK(recipe[i].pump);
+    }
+
+    if (mask & pumpSlotPumps()) {
+        return STATUS_PUMPS_OVERLAP;
+    }
+
+    // The schedule is fitted around the pumps of the running recipes, which
+    // keep switching meanwhile. So it is planned to start a bit later, and
+    // again further ahead if planning took longer than that.
+    PumpEvent events[PUMP_MAX_EVENTS];
+    ScheduleLoad load[PUMP_MAX_EVENTS + 1];
+    uint32_t start[RECIPE_MAX_INGREDIENTS];
+    uint32_t margin = PUMP_START_MARGIN;
+    uint8_t count, loads, sreg;
+    uint64_t begin, now;
+    for (;;) {
+        begin = getSystemTime() + margin;
+        loads = pumpLoad(begin, events, load);
+
+        // start times within the power budget, no earlier than the aligned delays
+#ifdef DEBUG_PUMPS
+        uint32_t scheduleStart = getSystemMicros();
+#endif // DEBUG_PUMPS
+        uint32_t end = scheduleRecipe(recipe, ingredients, align, pumpWeight, pumpBudget,
+                load, loads, start);
 #ifdef DEBUG_PUMPS
-    serialWriteString(1, "Debug: next pump to turn off: ");
-    serialWriteInt16(1, recipe[pumpLastIndex].pump);
-    serialWriteString(1, " in ");
-    serialWriteInt16(1, recipe[pumpLastIndex].time);
-    serialWriteString(1, "\nDebug: turning on all pumps\n");
+        serialWriteLiteral(1, "Debug: scheduled in ");
+        serialWriteInt32(1, getSystemMicros() - scheduleStart);
+        serialWriteLiteral(1, "us, ");
+        serialWriteInt32(1, end);
+        serialWriteLiteral(1, "ms total\n");
 #endif // DEBUG_PUMPS
+        if (end == 0) {
+            return STATUS_INVALID_TIME;
+        }
 
-    for (uint8_t i = 0; i < ingredients; i++) {
-        pumpSet(recipe[i].pump, 1); // turn on all pumps in recipe
+        // compile the recipe into a timeline, so the ISR only has to step through it.
+        // each pump starts at its scheduled time and runs for its time.
+        count = 0;
+        for (uint8_t i = 0; i < ingredients; i++) {
+            uint32_t pump = PUMP_MASK(recipe[i].pump);
+            pumpAddEvent(events, &count, start[i], pump, 0);
+            pumpAddEvent(events, &count, start[i] + recipe[i].time, 0, pump);
+        }
+        events[count - 1].done = bit;
+
+#ifdef DEBUG_PUMPS
+        for (uint8_t i = 0; i < count; i++) {
+            serialWriteLiteral(1, "Debug: at ");
+            serialWriteInt32(1, events[i].time);
+            serialWriteLiteral(1, "ms on ");
+            serialWriteInt32(1, events[i].on);
+            serialWriteLiteral(1, " off ");
+            serialWriteInt32(1, events[i].off);
+            serialWriteLiteral(1, "\n");
+        }
+#endif // DEBUG_PUMPS
+
+        sreg = SREG;
+        cli();
+        now = getSystemTime();
+        if ((loads == 0) || (now <= begin)) {
+            break; // interrupts stay disabled
+        }
+        SREG = sreg;
+        margin *= 2;
     }
 
-    quickTimeFireIn(pumpLastTime, pumpHandleRecipeState);
+    // without running recipes, nothing depends on the exact start
+    pumpStop();
+    pumpMergeEvents(now - pumpStartTime, (loads > 0) ? (begin - now) : 0, events, count);
+    pumpStartTime = now;
+    pumpSlotMask[slot] = mask;
+    pumpSlotRunning |= bit;
+    pumpSlotFinished &= ~bit;
+    pumpRunning = 1;
+
+    // Turn on 2nd status LED while dispensing
+    PORTE.OUTCLR = PIN7_bm;
+
+    pumpPlay(0);
+    SREG = sreg;
+
+    return STATUS_OK;
 }
 
@@ -6,6 +6,10 @@
  * To ensure the amount of liquids dispensed is accurate, we first transmit
  * all the required pumps and their durations before starting them all at once.
  *
+ * There are RECIPE_SLOTS independent recipes, one for each nozzle. All
+ * commands work on the selected slot, the slots can be dispensed at the
+ * same time when they use different pumps.
+ *
  * Copyright (c) 2017 Thomas Buck <xythobuz@xythobuz.de>
  * All rights reserved.
  */
@@ -15,80 +19,122 @@
 #include <stdint.h>
 
 #include "config.h"
+#include "status.h"
 #include "serial.h"
 #include "pumps.h"
 #include "recipe.h"
 
-static RecipeIngredient ingredients[RECIPE_MAX_INGREDIENTS];
-static uint8_t ingredientCount = 0;
+typedef struct {
+    RecipeIngredient ingredients[RECIPE_MAX_INGREDIENTS];
+    uint8_t count;
+    uint8_t alignment;
+} RecipeSlot;
+
+static RecipeSlot slots[RECIPE_SLOTS];
+static uint8_t selected = 0;
+static RecipeSlot *current = &slots[0];
 
 #define FLAG_STATE_PUMP (1 << 0)
 #define FLAG_STATE_TIME (1 << 1)
 #define FLAG_STATE_DELAY (1 << 2)
+#define FLAG_STATE_STORED (1 << 3) // nothing changed since the last store
 
 static uint8_t statePump = 0;
-static uint16_t stateTime = 0;
-static uint16_t stateDelay = 0;
+static uint32_t stateTime = 0;
+static uint32_t stateDelay = 0;
 static uint8_t state = 0;
 
-void recipeReset(uint16_t arg) {
-    ingredientCount = 0;
+// the ingredient being entered is dropped
+static void recipeClearState(void) {
     statePump = 0;
     stateTime = 0;
     stateDelay = 0;
     state = 0;
 }
 
-void recipePump(uint16_t arg) {
-    if ((arg < 1) || (arg > 20)) {
-        serialWriteString(1, "Error: invalid pump id!\n");
-        return;
+uint8_t recipeReset(void) {
+    current->count = 0;
+    current->alignment = RECIPE_ALIGN_START;
+    recipeClearState();
+    return STATUS_OK;
+}
+
+uint8_t recipeSelect(uint32_t slot) {
+    if (slot >= RECIPE_SLOTS) {
+        return STATUS_INVALID_PARAMETER;
     }
 
-    if (ingredientCount >= RECIPE_MAX_INGREDIENTS) {
-        serialWriteString(1, "Error: too many ingredients in recipe!\n");
-        return;
+    selected = slot;
+    current = &slots[slot];
+    recipeClearState();
+    return STATUS_OK;
+}
+
+uint8_t recipeSelected(void) {
+    return selected;
+}
+
+uint8_t recipePump(uint32_t pump) {
+    if ((pump < 1) || (pump > 20)) {
+        return STATUS_INVALID_PUMP;
+    }
+
+    if (current->count >= RECIPE_MAX_INGREDIENTS) {
+        return STATUS_TOO_MANY_INGREDIENTS;
     }
 
-    statePump = arg;
-    state |= FLAG_STATE_PUMP;
+    statePump = pump;
+    state = (state & ~FLAG_STATE_STORED) | FLAG_STATE_PUMP;
+    return STATUS_OK;
 }
 
-void recipeDuration(uint16_t arg) {
-    if (arg == 0) {
-        serialWriteString(1, "Error: only positive integer times are allowed!\n");
-        return;
+uint8_t recipeDuration(uint32_t time) {
+    if (time == 0) {
+        return STATUS_INVALID_TIME;
     }
 
-    if (ingredientCount >= RECIPE_MAX_INGREDIENTS) {
-        serialWriteString(1, "Error: too many ingredients in recipe!\n");
-        return;
+    if (current->count >= RECIPE_MAX_INGREDIENTS) {
+        return STATUS_TOO_MANY_INGREDIENTS;
     }
 
-    stateTime = arg;
-    state |= FLAG_STATE_TIME;
+    stateTime = time;
+    state = (state & ~FLAG_STATE_STORED) | FLAG_STATE_TIME;
+    return STATUS_OK;
 }
 
-void recipeDelay(uint16_t arg) {
-	stateDelay = arg;
-	state |= FLAG_STATE_DELAY;
+uint8_t recipeDelay(uint32_t delay) {
+	stateDelay = delay;
+	state = (state & ~FLAG_STATE_STORED) | FLAG_STATE_DELAY;
+	return STATUS_OK;
 }
 
-void recipeStore(uint16_t arg) {
-    if (ingredientCount >= RECIPE_MAX_INGREDIENTS) {
-        serialWriteString(1, "Error: too many ingredients in recipe!\n");
-        return;
+uint8_t recipeAlign(uint32_t align) {
+    if (align > RECIPE_ALIGN_CENTER) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    current->alignment = align;
+    return STATUS_OK;
+}
+
+uint8_t recipeStore(void) {
+    // already stored, for example by p with d or w followed by s
+    if (state & FLAG_STATE_STORED) {
+        return STATUS_OK;
+    }
+
+    if (current->count >= RECIPE_MAX_INGREDIENTS) {
+        return STATUS_TOO_MANY_INGREDIENTS;
     }
 
     if ((!(state & FLAG_STATE_PUMP)) || (!(state & FLAG_STATE_TIME))) {
-        serialWriteString(1, "Error: can't store without pump and time!\n");
-        return;
+        return STATUS_INCOMPLETE_INGREDIENT;
     }
 
     /* search if this pump is already in use */
     uint8_t exists = 0, i;
-    for (i = 0; i < ingredientCount; i++) {
-        if (ingredients[i].pump == statePump) {
+    for (i = 0; i < current->count; i++) {
+        if (current->ingredients[i].pump == statePump) {
             exists = 1;
             break;
         }
@@ -96,47 +142,68 @@ void recipeStore(uint16_t arg) {
 
     if (exists) {
         /* entry for this pump already exists -> overwrite */
-        ingredients[i].pump = statePump;
-        ingredients[i].time = stateTime;
-        ingredients[i].delay = stateDelay;
+        current->ingredients[i].pump = statePump;
+        current->ingredients[i].time = stateTime;
+        current->ingredients[i].delay = stateDelay;
     } else {
-        ingredients[ingredientCount].pump = statePump;
-        ingredients[ingredientCount].time = stateTime;
-        ingredients[ingredientCount].delay = stateDelay;
-        ingredientCount++;
+        current->ingredients[current->count].pump = statePump;
+        current->ingredients[current->count].time = stateTime;
+        current->ingredients[current->count].delay = stateDelay;
+        current->count++;
     }
+
+    // pump and duration carry over to the next ingredient, the delay does not
+    stateDelay = 0;
+    state = (state & ~FLAG_STATE_DELAY) | FLAG_STATE_STORED;
+    return STATUS_OK;
 }
 
-void recipeGo(uint16_t arg) {
-    if (ingredientCount == 0) {
-        serialWriteString(1, "Error: no ingredients stored!\n");
-        return;
+uint8_t recipeGo(void) {
+    if (current->count == 0) {
+        return STATUS_NO_INGREDIENTS;
     }
 
-    // Turn on 2nd status LED while dispensing
-    PORTE.OUTCLR = PIN7_bm;
+    // start dispensing, continues in the background. The pumps module
+    // compiles its own timeline, so the slot keeps the recipe for another go.
+    return pumpsRecipe(selected, current->ingredients, current->count,
+            current->alignment);
+}
+
+uint8_t recipeCount(void) {
+    return current->count;
+}
 
-    // start dispensing
-    pumpsRecipe(ingredients, ingredientCount);
+uint8_t recipeAlignment(void) {
+    return current->alignment;
+}
 
-    // wait until dispension is finished
-    while (pumpsDispensing());
-    PORTE.OUTSET = PIN7_bm;
-    recipeReset(0);
+const RecipeIngredient *recipeIngredient(uint8_t i) {
+    return &current->ingredients[i];
 }
 
-void recipeList(uint16_t arg) {
-    serialWriteString(1, "Stored ");
-    serialWriteInt16(1, ingredientCount);
-    serialWriteString(1, " ingredients\n");
-    for (uint8_t i = 0; i < ingredientCount; i++) {
-        serialWriteString(1, "Pump ");
-        serialWriteInt16(1, ingredients[i].pump);
-        serialWriteString(1, " running for ");
-        serialWriteInt16(1, ingredients[i].time);
-        serialWriteString(1, "ms after ");
-        serialWriteInt16(1, ingredients[i].delay);
-        serialWriteString(1, "ms\n");
+uint8_t recipeList(void) {
+    serialWriteLiteral(1, "Slot ");
+    serialWriteInt16(1, selected);
+    serialWriteLiteral(1, ": stored ");
+    serialWriteInt16(1, current->count);
+    serialWriteLiteral(1, " ingredients, aligned at the ");
+    if (current->alignment == RECIPE_ALIGN_END) {
+        serialWriteLiteral(1, "end\n");
+    } else if (current->alignment == RECIPE_ALIGN_CENTER) {
+        serialWriteLiteral(1, "center\n");
+    } else {
+        serialWriteLiteral(1, "start\n");
+    }
+    for (uint8_t i = 0; i < current->count; i++) {
+        serialWriteLiteral(1, "Pump ");
+        serialWriteInt16(1, current->ingredients[i].pump);
+        serialWriteLiteral(1, " running for ");
+        serialWriteInt32(1, current->ingredients[i].time);
+        serialWriteLiteral(1, "ms after ");
+        serialWriteInt32(1, current->ingredients[i].delay);
+        serialWriteLiteral(1, "ms\n");
     }
+
+    return STATUS_OK;
 }
 
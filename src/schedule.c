@@ -0,0 +1,227 @@
+/*
+ * schedule.c
+ * avr_pump_board
+ *
+ * Each ingredient is released at its delay, after shifting it so that all
+ * ingredients start together, end together or are centered on the longest.
+ *
+ * Greedy list scheduling: whenever a pump turns off or an ingredient has
+ * been released, the waiting ingredients are started in priority order, as
+ * long as they fit into the remaining budget. Lower priority ingredients
+ * may start first when a higher one does not fit yet.
+ *
+ * Two priority orders are tried and the shorter schedule is kept:
+ * longest running time first (LPT), and largest time * weight first,
+ * which does better when a few heavy pumps block the budget.
+ *
+ * Pumps that are already running, from recipes in other slots, are given
+ * as a load profile. An ingredient only starts when the budget left by
+ * that profile suffices for its whole running time. The profile only
+ * changes at its entries, so these are points in time to continue at, too.
+ *
+ * Each order takes O(n^2) steps, one pass over the ingredients for every
+ * point in time a pump turns off or an ingredient is released. The second
+ * order is skipped when all weights are equal, as it would be the same.
+ *
+ * Copyright (c) 2017 Thomas Buck <xythobuz@xythobuz.de>
+ * All rights reserved.
+ */
+
+#include <stdint.h>
+
+#include "config.h"
+#include "schedule.h"
+
+#define SCHEDULE_NEVER 0xFFFFFFFF
+
+// ingredient state during scheduling
+#define SCHEDULE_WAITING 0
+#define SCHEDULE_RUNNING 1
+#define SCHEDULE_DONE 2
+
+// Insertion sort of the ingredient indices, highest key first
+static void scheduleOrder(const uint32_t *key, uint8_t count, uint8_t *order) {
+    for (uint8_t i = 0; i < count; i++) {
+        uint8_t j = i;
+        while ((j > 0) && (key[order[j - 1]] < key[i])) {
+            order[j] = order[j - 1];
+            j--;
+        }
+        order[j] = i;
+    }
+}
+
+// Highest load from time from up to, but not including, time to
+static uint16_t scheduleLoadMax(const ScheduleLoad *load, uint8_t loads, uint32_t from, uint32_t to) {
+    uint16_t max = 0;
+    for (uint8_t i = 0; (i < loads) && (load[i].time < to); i++) {
+        if (load[i].time <= from) {
+            max = load[i].level; // level at from
+        } else if (load[i].level > max) {
+            max = load[i].level;
+        }
+    }
+    return max;
+}
+
+static uint32_t scheduleList(const RecipeIngredient *recipe, uint8_t count, const uint32_t *release,
+        const uint8_t *weight, uint16_t budget, const ScheduleLoad *load, uint8_t loads,
+        const uint8_t *order, uint32_t *start) {
+    uint8_t state[RECIPE_MAX_INGREDIENTS];
+    uint32_t finish[RECIPE_MAX_INGREDIENTS];
+    for (uint8_t i = 0; i < count; i++) {
+        state[i] = SCHEDULE_WAITING;
+    }
+
+    uint8_t waiting = count;
+    uint16_t used = 0;
+    uint32_t now = 0, end = 0;
+    uint8_t change = 0; // next entry of the load profile
+
+    for (;;) {
+        for (uint8_t i = 0; i < count; i++) {
+            if ((state[i] == SCHEDULE_RUNNING) && (finish[i] <= now)) {
+                state[i] = SCHEDULE_DONE;
+                used -= weight[i];
+            }
+        }
+
+        // start what fits, then continue when a pump turns off, a delay has
+        // passed or the load changes
+        while ((change < loads) && (load[change].time <= now)) {
+            change++;
+        }
+        uint32_t next = (change < loads) ? load[change].time : SCHEDULE_NEVER;
+        for (uint8_t k = 0; k < count; k++) {
+            uint8_t i = order[k];
+            if (state[i] == SCHEDULE_WAITING) {
+                if (release[i] > now) {
+                    if (release[i] < next) {
+                        next = release[i];
+                    }
+                    continue;
+                }
+                if ((used + weight[i]) > budget) {
+                    continue;
+                }
+                if ((loads > 0) && ((used + weight[i]
+                        + scheduleLoadMax(load, loads, now, now + recipe[i].time)) > budget)) {
+                    continue;
+                }
+
+                state[i] = SCHEDULE_RUNNING;
+                start[i] = now;
+                finish[i] = now + recipe[i].time;
+                used += weight[i];
+                waiting--;
+                if (finish[i] > end) {
+                    end = finish[i];
+                }
+            }
+
+            if ((state[i] == SCHEDULE_RUNNING) && (finish[i] < next)) {
+                next = finish[i];
+            }
+        }
+
+        if (waiting == 0) {
+            return end;
+        }
+        if (next == SCHEDULE_NEVER) {
+            return 0; // remaining ingredients never fit into the budget
+        }
+        now = next;
+    }
+}
+
+// Earliest start of each ingredient: its alignment offset plus its delay
+static uint8_t scheduleRelease(const RecipeIngredient *recipe, uint8_t count,
+        uint8_t align, uint32_t *release) {
+    uint32_t longest = 0;
+    for (uint8_t i = 0; i < count; i++) {
+        if (recipe[i].time > longest) {
+            longest = recipe[i].time;
+        }
+    }
+
+    for (uint8_t i = 0; i < count; i++) {
+        uint32_t offset = 0;
+        if (align == RECIPE_ALIGN_END) {
+            offset = longest - recipe[i].time;
+        } else if (align == RECIPE_ALIGN_CENTER) {
+            offset = (longest - recipe[i].time) / 2;
+        }
+
+        if (recipe[i].delay > (0xFFFFFFFF - offset)) {
+            return 0;
+        }
+        release[i] = offset + recipe[i].delay;
+    }
+
+    return 1;
+}
+
+uint32_t scheduleRecipe(const RecipeIngredient *recipe, uint8_t count, uint8_t align,
+        const uint8_t *pumpWeight, uint16_t budget, const ScheduleLoad *load, uint8_t loads,
+        uint32_t *start) {
+    if ((count == 0) || (count > RECIPE_MAX_INGREDIENTS)) {
+        return 0;
+    }
+
+    uint32_t release[RECIPE_MAX_INGREDIENTS];
+    if (!scheduleRelease(recipe, count, align, release)) {
+        return 0;
+    }
+
+    // no greedy schedule idles longer than the latest release or load change
+    uint32_t limit = (loads > 0) ? load[loads - 1].time : 0;
+    uint32_t total = 0;
+    for (uint8_t i = 0; i < count; i++) {
+        if (release[i] > limit) {
+            limit = release[i];
+        }
+        if (recipe[i].time > (0xFFFFFFFF - total)) {
+            return 0;
+        }
+        total += recipe[i].time;
+    }
+    if (total > (0xFFFFFFFF - limit)) {
+        return 0;
+    }
+
+    uint8_t weight[RECIPE_MAX_INGREDIENTS];
+    uint32_t key[RECIPE_MAX_INGREDIENTS];
+    uint8_t order[RECIPE_MAX_INGREDIENTS];
+    uint8_t uniform = 1;
+    for (uint8_t i = 0; i < count; i++) {
+        weight[i] = pumpWeight[recipe[i].pump - 1];
+        key[i] = recipe[i].time;
+        if (weight[i] != weight[0]) {
+            uniform = 0;
+        }
+    }
+
+    scheduleOrder(key, count, order);
+    uint32_t best = scheduleList(recipe, count, release, weight, budget, load, loads, order, start);
+    if ((best == 0) || uniform) {
+        return best; // both orders are the same with equal weights
+    }
+
+    uint32_t other[RECIPE_MAX_INGREDIENTS];
+    for (uint8_t i = 0; i < count; i++) {
+        uint64_t area = (uint64_t)recipe[i].time * weight[i];
+        key[i] = (area > 0xFFFFFFFF) ? 0xFFFFFFFF : area;
+    }
+
+    scheduleOrder(key, count, order);
+    uint32_t area = scheduleList(recipe, count, release, weight, budget, load, loads, order, other);
+    if (area < best) {
+        best = area;
+        for (uint8_t i = 0; i < count; i++) {
+            start[i] = other[i];
+        }
+    }
+
+    return best;
+}
+
@@ -30,6 +30,7 @@
 #include <avr/io.h>
 #include <avr/interrupt.h>
 #include <stdint.h>
+#include <string.h>
 
 #include "serial.h"
 #include "serial_device.h"
@@ -50,6 +51,19 @@
  */
 #define SERIALINJECTCR
 
+/** If you define this to a UART id, the TX buffer of that UART is drained by a
+ *  DMA channel in contiguous chunks, instead of one interrupt per byte.
+ *  All other UARTs keep using the transmit interrupt. XMega only!
+ */
+#define SERIALDMATX 1
+
+/** If you define this to a UART id, a DMA channel writes the received bytes of
+ *  that UART straight into its RX ring buffer, without any receive interrupt.
+ *  The write position is fetched from the DMA controller when the buffer is
+ *  checked. RX_BUFFER_SIZE has to be a power of 2. XMega only!
+ */
+#define SERIALDMARX 1
+
 #ifndef UART_XMEGA
 
 #ifndef RX_BUFFER_SIZE
@@ -79,6 +93,61 @@
 #define XON 0x11 /**< XON Value */
 #define XOFF 0x13 /**< XOFF Value */
 
+/** Define SERIAL_UART (usually from the makefile) to a UART id to build a
+ *  driver specialized for this single UART. Buffers are only reserved for it,
+ *  its registers are accessed at constant addresses and the interrupts of
+ *  all other UARTs are not compiled in. The API stays the same, calls for
+ *  other UARTs are ignored.
+ */
+#ifdef SERIAL_UART
+
+#if (SERIAL_UART < 0) || (SERIAL_UART >= UART_COUNT)
+#error SERIAL_UART IS NOT A VALID UART!
+#endif
+
+#define UARTSLOTS 1 /**< Number of UARTs with buffers */
+#define UARTSLOT(uart) 0 /**< Buffer index for a UART */
+#define UARTID(uart) SERIAL_UART /**< Register table index for a UART */
+#define UARTVALID(uart) ((uart) == SERIAL_UART) /**< Check a UART id at runtime */
+#define UARTUSED(uart) ((uart) == SERIAL_UART) /**< Check a UART id at compile-time */
+
+#else // SERIAL_UART
+
+#define UARTSLOTS UART_COUNT
+#define UARTSLOT(uart) (uart)
+#define UARTID(uart) (uart)
+#define UARTVALID(uart) ((uart) < UART_COUNT)
+#define UARTUSED(uart) ((uart) < UART_COUNT)
+
+#endif // SERIAL_UART
+
+#ifdef SERIALDMATX
+#ifndef UART_XMEGA
+#error SERIALDMATX NEEDS A DMA CONTROLLER!
+#endif
+#ifdef FLOWCONTROL
+#error SERIALDMATX CAN NOT BE USED WITH FLOWCONTROL!
+#endif
+#if !UARTUSED(SERIALDMATX)
+#error SERIALDMATX IS NOT A VALID UART!
+#endif
+#endif
+
+#ifdef SERIALDMARX
+#ifndef UART_XMEGA
+#error SERIALDMARX NEEDS A DMA CONTROLLER!
+#endif
+#ifdef FLOWCONTROL
+#error SERIALDMARX CAN NOT BE USED WITH FLOWCONTROL!
+#endif
+#if !UARTUSED(SERIALDMARX)
+#error SERIALDMARX IS NOT A VALID UART!
+#endif
+#if (RX_BUFFER_SIZE & (RX_BUFFER_SIZE - 1)) != 0
+#error SERIALDMARX NEEDS A POWER OF 2 RX BUFFER SIZE!
+#endif
+#endif
+
 #if (RX_BUFFER_SIZE < 2) || (TX_BUFFER_SIZE < 2)
 #error SERIAL BUFFER TOO SMALL!
 #endif
@@ -89,7 +158,7 @@
 #endif
 #endif
 
-#if ((RX_BUFFER_SIZE + TX_BUFFER_SIZE) * UART_COUNT) >= (RAMEND - 0x60)
+#if ((RX_BUFFER_SIZE + TX_BUFFER_SIZE) * UARTSLOTS) >= (RAMEND - 0x60)
 #error SERIAL BUFFER TOO LARGE!
 #endif
 
@@ -118,107 +187,190 @@
 
 #endif // UART_XMEGA
 
-static uint8_t volatile rxBuffer[UART_COUNT][RX_BUFFER_SIZE];
-static uint8_t volatile txBuffer[UART_COUNT][TX_BUFFER_SIZE];
-static uint16_t volatile rxRead[UART_COUNT];
-static uint16_t volatile rxWrite[UART_COUNT];
-static uint16_t volatile txRead[UART_COUNT];
-static uint16_t volatile txWrite[UART_COUNT];
-static uint8_t volatile shouldStartTransmission[UART_COUNT];
+static uint8_t volatile rxBuffer[UARTSLOTS][RX_BUFFER_SIZE];
+static uint8_t volatile txBuffer[UARTSLOTS][TX_BUFFER_SIZE];
+static uint16_t volatile rxRead[UARTSLOTS];
+static uint16_t volatile rxWrite[UARTSLOTS];
+static uint16_t volatile txRead[UARTSLOTS];
+static uint16_t volatile txWrite[UARTSLOTS];
+static uint8_t volatile shouldStartTransmission[UARTSLOTS];
+static uint16_t volatile rxOverruns[UARTSLOTS];
 
 #ifdef FLOWCONTROL
-static uint8_t volatile sendThisNext[UART_COUNT];
-static uint8_t volatile flow[UART_COUNT];
-static uint16_t volatile rxBufferElements[UART_COUNT];
+static uint8_t volatile sendThisNext[UARTSLOTS];
+static uint8_t volatile flow[UARTSLOTS];
+static uint16_t volatile rxBufferElements[UARTSLOTS];
+#endif
+
+#ifdef SERIALDMATX
+static uint16_t volatile txDmaLength;
+static uint8_t volatile txDmaUnflushed;
+#endif
+
+#ifdef SERIALDMARX
+static uint16_t volatile rxDmaBlocks; // completed passes over the RX buffer
+static uint16_t rxDmaReceived; // bytes written by the DMA (modulo 2^16)
+static uint16_t rxDmaConsumed; // bytes read with serialGet (modulo 2^16)
 #endif
 
 static void serialReceiveInterrupt(uint8_t uart);
 static void serialTransmitInterrupt(uint8_t uart);
+static void serialStartTransmission(uint8_t uart);
+static void serialReceiveSync(uint8_t uart);
 
 uint8_t serialAvailable(void) {
     return UART_COUNT;
 }
 
 void serialWriteInt16(uint8_t uart, uint16_t num) {
-    if (uart >= UART_COUNT) {
+    if (!UARTVALID(uart)) {
         return;
     }
 
-    uint8_t buf[5] = { 0, 0, 0, 0, 0 };
-    uint8_t n = 0;
-    if (num == 0) {
-        n = 1;
-    } else {
-        while (num > 0) {
-            buf[n++] = num % 10;
-            num /= 10;
-        }
-    }
+    // Fill the digits from the back, then send them all at once
+    uint8_t buf[5];
+    uint8_t n = sizeof(buf);
+    do {
+        buf[--n] = (num % 10) + '0';
+        num /= 10;
+    } while (num > 0);
+
+    serialWriteBuffer(uart, buf + n, sizeof(buf) - n);
+}
 
-    for (int8_t i = n - 1; i >= 0; i--) {
-        serialWrite(uart, buf[i] + '0');
+void serialWriteInt32(uint8_t uart, uint32_t num) {
+    if (!UARTVALID(uart)) {
+        return;
     }
+
+    uint8_t buf[10];
+    uint8_t n = sizeof(buf);
+    do {
+        buf[--n] = (num % 10) + '0';
+        num /= 10;
+    } while (num > 0);
+
+    serialWriteBuffer(uart, buf + n, sizeof(buf) - n);
 }
 
 void serialInit(uint8_t uart, uint16_t baud) {
-    if (uart >= UART_COUNT) {
+    if (!UARTVALID(uart)) {
         return;
     }
 
     // Initialize state variables
-    rxRead[uart] = 0;
-    rxWrite[uart] = 0;
-    txRead[uart] = 0;
-    txWrite[uart] = 0;
-    shouldStartTransmission[uart] = 1;
+    rxRead[UARTSLOT(uart)] = 0;
+    rxWrite[UARTSLOT(uart)] = 0;
+    txRead[UARTSLOT(uart)] = 0;
+    txWrite[UARTSLOT(uart)] = 0;
+    shouldStartTransmission[UARTSLOT(uart)] = 1;
+    rxOverruns[UARTSLOT(uart)] = 0;
 
 #ifdef FLOWCONTROL
-    sendThisNext[uart] = 0;
-    flow[uart] = 1;
-    rxBufferElements[uart] = 0;
+    sendThisNext[UARTSLOT(uart)] = 0;
+    flow[UARTSLOT(uart)] = 1;
+    rxBufferElements[UARTSLOT(uart)] = 0;
 #endif // FLOWCONTROL
 
 #ifndef UART_XMEGA
 
     // Default Configuration: 8N1
-    *serialRegisters[uart][SERIALC] = (1 << serialBits[uart][SERIALUCSZ0])
-            | (1 << serialBits[uart][SERIALUCSZ1]);
+    *serialRegisters[UARTID(uart)][SERIALC] = (1 << serialBits[UARTID(uart)][SERIALUCSZ0])
+            | (1 << serialBits[UARTID(uart)][SERIALUCSZ1]);
 
     // Set baudrate
 #if SERIALBAUDBIT == 8
-    *serialRegisters[uart][SERIALUBRRH] = (baud >> 8);
-    *serialRegisters[uart][SERIALUBRRL] = baud;
+    *serialRegisters[UARTID(uart)][SERIALUBRRH] = (baud >> 8);
+    *serialRegisters[UARTID(uart)][SERIALUBRRL] = baud;
 #else // SERIALBAUDBIT == 8
-    *serialBaudRegisters[uart] = baud;
+    *serialBaudRegisters[UARTID(uart)] = baud;
 #endif // SERIALBAUDBIT == 8
 
     // Enable Interrupts
-    *serialRegisters[uart][SERIALB] = (1 << serialBits[uart][SERIALRXCIE]);
+    *serialRegisters[UARTID(uart)][SERIALB] = (1 << serialBits[UARTID(uart)][SERIALRXCIE]);
 
     // Enable Receiver/Transmitter
-    *serialRegisters[uart][SERIALB] |= (1 << serialBits[uart][SERIALRXEN])
-            | (1 << serialBits[uart][SERIALTXEN]);
+    *serialRegisters[UARTID(uart)][SERIALB] |= (1 << serialBits[UARTID(uart)][SERIALRXEN])
+            | (1 << serialBits[UARTID(uart)][SERIALTXEN]);
 
 #else // UART_XMEGA
 
     // Default Configuration: 8N1
-    serialRegisters[uart]->CTRLC = 0x03;
+    serialRegisters[UARTID(uart)]->CTRLC = 0x03;
 
     // Set baudrate
-    serialRegisters[uart]->BAUDCTRLB = (baud & 0x0F00) >> 8;
-    serialRegisters[uart]->BAUDCTRLA = (baud & 0x00FF);
+    serialRegisters[UARTID(uart)]->BAUDCTRLB = (baud & 0x0F00) >> 8;
+    serialRegisters[UARTID(uart)]->BAUDCTRLA = (baud & 0x00FF);
 
     // Enable Interrupts
-    serialRegisters[uart]->CTRLA = UART_INTERRUPT_LEVEL_RX << 4; // RXCINTLVL
+    serialRegisters[UARTID(uart)]->CTRLA = UART_INTERRUPT_LEVEL_RX << 4; // RXCINTLVL
+
+#ifdef SERIALDMARX
+    if (uart == SERIALDMARX) {
+        // Bytes are fetched by the DMA controller, not the interrupt
+        serialRegisters[UARTID(uart)]->CTRLA = 0;
+
+        rxDmaBlocks = 0;
+        rxDmaReceived = 0;
+        rxDmaConsumed = 0;
+        DMA.CTRL |= DMA_ENABLE_bm;
+
+        // Endlessly repeated blocks, one byte for each received character
+        SERIALDMARXCHANNEL.CTRLA = DMA_CH_REPEAT_bm | DMA_CH_SINGLE_bm
+                | DMA_CH_BURSTLEN_1BYTE_gc;
+        SERIALDMARXCHANNEL.REPCNT = 0;
+
+        // Interrupt after each pass over the buffer, to count overruns
+        SERIALDMARXCHANNEL.CTRLB = DMA_CH_TRNIF_bm
+                | (UART_INTERRUPT_LEVEL_RX << DMA_CH_TRNINTLVL_gp);
+
+        // Always read the data register, wrap around at the end of the buffer
+        SERIALDMARXCHANNEL.ADDRCTRL = DMA_CH_SRCRELOAD_NONE_gc | DMA_CH_SRCDIR_FIXED_gc
+                | DMA_CH_DESTRELOAD_BLOCK_gc | DMA_CH_DESTDIR_INC_gc;
+        SERIALDMARXCHANNEL.TRIGSRC = serialDmaRxTriggers[UARTID(uart)];
+        SERIALDMARXCHANNEL.TRFCNT = RX_BUFFER_SIZE;
+
+        SERIALDMARXCHANNEL.SRCADDR0 = ((uint16_t)&serialRegisters[UARTID(uart)]->DATA & 0x00FF);
+        SERIALDMARXCHANNEL.SRCADDR1 = ((uint16_t)&serialRegisters[UARTID(uart)]->DATA & 0xFF00) >> 8;
+        SERIALDMARXCHANNEL.SRCADDR2 = 0x00;
+        SERIALDMARXCHANNEL.DESTADDR0 = ((uint16_t)rxBuffer[UARTSLOT(uart)] & 0x00FF);
+        SERIALDMARXCHANNEL.DESTADDR1 = ((uint16_t)rxBuffer[UARTSLOT(uart)] & 0xFF00) >> 8;
+        SERIALDMARXCHANNEL.DESTADDR2 = 0x00;
+
+        SERIALDMARXCHANNEL.CTRLA |= DMA_CH_ENABLE_bm;
+    }
+#endif // SERIALDMARX
 
     // Enable Receiver/Transmitter
-    serialRegisters[uart]->CTRLB = 0x18;
+    serialRegisters[UARTID(uart)]->CTRLB = 0x18;
+
+#ifdef SERIALDMATX
+    if (uart == SERIALDMATX) {
+        txDmaLength = 0;
+        txDmaUnflushed = 0;
+        DMA.CTRL |= DMA_ENABLE_bm;
+
+        // Single-shot byte transfers, each triggered by an empty data register
+        SERIALDMATXCHANNEL.CTRLA = DMA_CH_SINGLE_bm | DMA_CH_BURSTLEN_1BYTE_gc;
+        SERIALDMATXCHANNEL.CTRLB = DMA_CH_TRNIF_bm
+                | (UART_INTERRUPT_LEVEL_TX << DMA_CH_TRNINTLVL_gp);
+
+        // Walk through the ring buffer, always write to the data register
+        SERIALDMATXCHANNEL.ADDRCTRL = DMA_CH_SRCRELOAD_NONE_gc | DMA_CH_SRCDIR_INC_gc
+                | DMA_CH_DESTRELOAD_NONE_gc | DMA_CH_DESTDIR_FIXED_gc;
+        SERIALDMATXCHANNEL.TRIGSRC = serialDmaTxTriggers[UARTID(uart)];
+
+        SERIALDMATXCHANNEL.DESTADDR0 = ((uint16_t)&serialRegisters[UARTID(uart)]->DATA & 0x00FF);
+        SERIALDMATXCHANNEL.DESTADDR1 = ((uint16_t)&serialRegisters[UARTID(uart)]->DATA & 0xFF00) >> 8;
+        SERIALDMATXCHANNEL.DESTADDR2 = 0x00;
+    }
+#endif // SERIALDMATX
 
 #endif // UART_XMEGA
 }
 
 void serialClose(uint8_t uart) {
-    if (uart >= UART_COUNT) {
+    if (!UARTVALID(uart)) {
         return;
     }
 
@@ -229,11 +381,11 @@ void serialClose(uint8_t uart) {
     while (!serialTxBufferEmpty(uart));
 
     // Wait while Transmit Interrupt is on
-    while (*serialRegisters[uart][SERIALB] & (1 << serialBits[uart][SERIALUDRIE]));
+    while (*serialRegisters[UARTID(uart)][SERIALB] & (1 << serialBits[UARTID(uart)][SERIALUDRIE]));
 
     cli();
-    *serialRegisters[uart][SERIALB] = 0;
-    *serialRegisters[uart][SERIALC] = 0;
+    *serialRegisters[UARTID(uart)][SERIALB] = 0;
+    *serialRegisters[UARTID(uart)][SERIALC] = 0;
     SREG = sreg;
 
 #else // UART_XMEGA
@@ -244,71 +396,176 @@ void serialClose(uint8_t uart) {
 
     // TODO Wait while Transmit Interrupt is turned on
 
+#ifdef SERIALDMATX
+    if (uart == SERIALDMATX) {
+        while (SERIALDMATXCHANNEL.CTRLA & DMA_CH_ENABLE_bm);
+    }
+#endif // SERIALDMATX
+
     cli();
-    serialRegisters[uart]->CTRLA = 0;
-    serialRegisters[uart]->CTRLB = 0;
-    serialRegisters[uart]->CTRLC = 0;
+
+#ifdef SERIALDMARX
+    if (uart == SERIALDMARX) {
+        SERIALDMARXCHANNEL.CTRLA &= ~DMA_CH_ENABLE_bm;
+    }
+#endif // SERIALDMARX
+
+    serialRegisters[UARTID(uart)]->CTRLA = 0;
+    serialRegisters[UARTID(uart)]->CTRLB = 0;
+    serialRegisters[UARTID(uart)]->CTRLC = 0;
 
     // TODO restore interrupt state
 
 #endif // UART_XMEGA
 }
 
-#ifdef FLOWCONTROL
-void setFlow(uint8_t uart, uint8_t on) {
-    if (uart >= UART_COUNT) {
-        return;
+#ifdef UART_XMEGA
+
+uint8_t serialBaudCalculate(uint32_t rate, SerialBaud *baud) {
+    if ((rate < 100) || (baud == 0)) {
+        return 1;
     }
 
-    if (flow[uart] != on) {
-        if (on == 1) {
-            // Send XON
-            while (sendThisNext[uart] != 0);
-            sendThisNext[uart] = XON;
-            flow[uart] = 1;
-            if (shouldStartTransmission[uart]) {
-                shouldStartTransmission[uart] = 0;
+    uint32_t bestDiff = 0xFFFFFFFF;
 
-#ifndef UART_XMEGA
-                // Enable Interrupt
-                *serialRegisters[uart][SERIALB] |= (1 << serialBits[uart][SERIALUDRIE]);
+    for (uint8_t clk2x = 0; clk2x <= 1; clk2x++) {
+        // Samples per bit: 16 in normal, 8 in double speed mode
+        uint32_t denom = rate * (clk2x ? 8 : 16);
+        if (denom > F_CPU) {
+            continue;
+        }
 
-                // Trigger Interrupt
-                *serialRegisters[uart][SERIALA] |= (1 << serialBits[uart][SERIALUDRE]);
-#else // UART_XMEGA
-                // Enable Interrupt
-                serialRegisters[uart]->CTRLA |= UART_INTERRUPT_LEVEL_TX << 2; // TXCINTLVL
+        // Try BSCALE 0, -1, 1, -2, 2, ... so ties prefer the simple settings
+        for (uint8_t i = 0; i < 15; i++) {
+            int8_t bscale = (i & 0x01) ? -((i + 1) / 2) : (i / 2);
+            uint32_t bsel, actual;
+
+            if (bscale >= 0) {
+                // fbaud = fper / (2^BSCALE * S * (BSEL + 1))
+                if (denom > (0xFFFFFFFFul >> (bscale + 1))) {
+                    continue;
+                }
+                uint32_t d = denom << bscale;
+                bsel = (F_CPU + (d / 2)) / d;
+                if (bsel < 1) {
+                    continue;
+                }
+                bsel--;
+
+                d = (uint32_t)(clk2x ? 8 : 16) * (bsel + 1) << bscale;
+                actual = (F_CPU + (d / 2)) / d;
+            } else {
+                // fbaud = fper / (S * (2^BSCALE * BSEL + 1))
+                uint8_t k = -bscale;
+                uint32_t diff = F_CPU - denom;
+                if (diff > ((0xFFFFFFFFul - (denom / 2)) >> k)) {
+                    continue;
+                }
+                bsel = ((diff << k) + (denom / 2)) / denom;
+
+                // fbaud = (fper * 2^k) / (S * (BSEL + 2^k)), without overflow
+                uint32_t d = (uint32_t)(clk2x ? 8 : 16) * (bsel + (1 << k));
+                actual = ((F_CPU / d) << k) + ((((F_CPU % d) << k) + (d / 2)) / d);
+            }
 
-                // Trigger Interrupt
-                serialTransmitInterrupt(uart);
-#endif // UART_XMEGA
+            if (bsel > 0x0FFF) {
+                continue;
             }
-        } else {
-            // Send XOFF
-            sendThisNext[uart] = XOFF;
-            flow[uart] = 0;
-            if (shouldStartTransmission[uart]) {
-                shouldStartTransmission[uart] = 0;
 
-#ifndef UART_XMEGA
-                // Enable Interrupt
-                *serialRegisters[uart][SERIALB] |= (1 << serialBits[uart][SERIALUDRIE]);
+            // Only consider somewhat usable settings
+            uint32_t diff = (actual > rate) ? (actual - rate) : (rate - actual);
+            if ((diff > (rate / 10)) || (diff >= bestDiff)) {
+                continue;
+            }
 
-                // Trigger Interrupt
-                *serialRegisters[uart][SERIALA] |= (1 << serialBits[uart][SERIALUDRE]);
-#else // UART_XMEGA
-                // Enable Interrupt
-                serialRegisters[uart]->CTRLA |= UART_INTERRUPT_LEVEL_TX << 2; // TXCINTLVL
+            // Relative error in 0.01%
+            uint16_t error = (diff * 100) / (rate / 100);
+
+            bestDiff = diff;
+            baud->bsel = bsel;
+            baud->bscale = bscale;
+            baud->clk2x = clk2x;
+            baud->rate = actual;
+            baud->error = (actual >= rate) ? (int16_t)error : -(int16_t)error;
+        }
+    }
+
+    if (bestDiff == 0xFFFFFFFF) {
+        return 1;
+    }
+
+    return ((baud->error > SERIAL_BAUD_MAX_ERROR)
+            || (baud->error < -SERIAL_BAUD_MAX_ERROR)) ? 1 : 0;
+}
+
+void serialSetBaud(uint8_t uart, const SerialBaud *baud) {
+    if ((!UARTVALID(uart)) || (baud == 0)) {
+        return;
+    }
+
+    // BAUDCTRLB holds BSCALE and the upper 4 bits of BSEL
+    serialRegisters[UARTID(uart)]->BAUDCTRLB = ((baud->bscale & 0x0F) << USART_BSCALE_gp)
+            | ((baud->bsel & 0x0F00) >> 8);
+    serialRegisters[UARTID(uart)]->BAUDCTRLA = (baud->bsel & 0x00FF);
+
+    if (baud->clk2x) {
+        serialRegisters[UARTID(uart)]->CTRLB |= USART_CLK2X_bm;
+    } else {
+        serialRegisters[UARTID(uart)]->CTRLB &= ~USART_CLK2X_bm;
+    }
+}
 
-                // Trigger Interrupt
-                serialTransmitInterrupt(uart);
 #endif // UART_XMEGA
+
+void serialFlush(uint8_t uart) {
+    if (!UARTVALID(uart)) {
+        return;
+    }
+
+    // Wait until the interrupt (or DMA) has taken everything from the buffer
+    while (!serialTxBufferEmpty(uart));
+    while (!shouldStartTransmission[UARTSLOT(uart)]);
+
+#ifdef SERIALDMATX
+    if (uart == SERIALDMATX) {
+        // The DMA is finished when the last byte enters the data register
+        if (txDmaUnflushed) {
+            while (!(serialRegisters[UARTID(uart)]->STATUS & USART_TXCIF_bm));
+            txDmaUnflushed = 0;
+        }
+    }
+#endif // SERIALDMATX
+}
+
+#ifdef FLOWCONTROL
+void setFlow(uint8_t uart, uint8_t on) {
+    if (!UARTVALID(uart)) {
+        return;
+    }
+
+    if (flow[UARTSLOT(uart)] != on) {
+        if (on == 1) {
+            // Send XON
+            while (sendThisNext[UARTSLOT(uart)] != 0);
+            sendThisNext[UARTSLOT(uart)] = XON;
+            flow[UARTSLOT(uart)] = 1;
+            if (shouldStartTransmission[UARTSLOT(uart)]) {
+                shouldStartTransmission[UARTSLOT(uart)] = 0;
+                serialStartTransmission(uart);
+            }
+        } else {
+            // Send XOFF
+            sendThisNext[UARTSLOT(uart)] = XOFF;
+            flow[UARTSLOT(uart)] = 0;
+            if (shouldStartTransmission[UARTSLOT(uart)]) {
+                shouldStartTransmission[UARTSLOT(uart)] = 0;
+                serialStartTransmission(uart);
             }
         }
 
         // Wait until it's transmitted / while transmit interrupt is turned on
 #ifndef UART_XMEGA
-        while (*serialRegisters[uart][SERIALB] & (1 << serialBits[uart][SERIALUDRIE]));
+        while (*serialRegisters[UARTID(uart)][SERIALB] & (1 << serialBits[UARTID(uart)][SERIALUDRIE]));
 #else // UART_XMEGA
         // TODO Wait while transmit interrupt is turned on
 #endif
@@ -321,11 +578,13 @@ void setFlow(uint8_t uart, uint8_t on) {
 // ---------------------
 
 uint8_t serialHasChar(uint8_t uart) {
-    if (uart >= UART_COUNT) {
+    if (!UARTVALID(uart)) {
         return 0;
     }
 
-    if (rxRead[uart] != rxWrite[uart]) {
+    serialReceiveSync(uart);
+
+    if (rxRead[UARTSLOT(uart)] != rxWrite[UARTSLOT(uart)]) {
         // True if char available
         return 1;
     } else {
@@ -334,7 +593,7 @@ uint8_t serialHasChar(uint8_t uart) {
 }
 
 uint8_t serialGetBlocking(uint8_t uart) {
-    if (uart >= UART_COUNT) {
+    if (!UARTVALID(uart)) {
         return 0;
     }
 
@@ -343,47 +602,40 @@ uint8_t serialGetBlocking(uint8_t uart) {
 }
 
 uint8_t serialGet(uint8_t uart) {
-    if (uart >= UART_COUNT) {
+    if (!UARTVALID(uart)) {
         return 0;
     }
 
     uint8_t c;
 
-    if (rxRead[uart] != rxWrite[uart]) {
+    serialReceiveSync(uart);
+    if (rxRead[UARTSLOT(uart)] != rxWrite[UARTSLOT(uart)]) {
 #ifdef FLOWCONTROL
         // This should not underflow as long as the receive buffer is not empty
-        rxBufferElements[uart]--;
-
-        if ((flow[uart] == 0) && (rxBufferElements[uart] <= FLOWMARK)) {
-            while (sendThisNext[uart] != 0);
-            sendThisNext[uart] = XON;
-            flow[uart] = 1;
-            if (shouldStartTransmission[uart]) {
-                shouldStartTransmission[uart] = 0;
-
-#ifndef UART_XMEGA
-                // Enable Interrupt
-                *serialRegisters[uart][SERIALB] |= (1 << serialBits[uart][SERIALUDRIE]);
-
-                // Trigger Interrupt
-                *serialRegisters[uart][SERIALA] |= (1 << serialBits[uart][SERIALUDRE]);
-#else // UART_XMEGA
-                // Enable Interrupt
-                serialRegisters[uart]->CTRLA |= UART_INTERRUPT_LEVEL_TX << 2; // TXCINTLVL
-
-                // Trigger Interrupt
-                serialTransmitInterrupt(uart);
-#endif // UART_XMEGA
+        rxBufferElements[UARTSLOT(uart)]--;
+
+        if ((flow[UARTSLOT(uart)] == 0) && (rxBufferElements[UARTSLOT(uart)] <= FLOWMARK)) {
+            while (sendThisNext[UARTSLOT(uart)] != 0);
+            sendThisNext[UARTSLOT(uart)] = XON;
+            flow[UARTSLOT(uart)] = 1;
+            if (shouldStartTransmission[UARTSLOT(uart)]) {
+                shouldStartTransmission[UARTSLOT(uart)] = 0;
+                serialStartTransmission(uart);
             }
         }
 #endif // FLOWCONTROL
-        c = rxBuffer[uart][rxRead[uart]];
-        rxBuffer[uart][rxRead[uart]] = 0;
-        if (rxRead[uart] < (RX_BUFFER_SIZE - 1)) {
-            rxRead[uart]++;
+        c = rxBuffer[UARTSLOT(uart)][rxRead[UARTSLOT(uart)]];
+        rxBuffer[UARTSLOT(uart)][rxRead[UARTSLOT(uart)]] = 0;
+        if (rxRead[UARTSLOT(uart)] < (RX_BUFFER_SIZE - 1)) {
+            rxRead[UARTSLOT(uart)]++;
         } else {
-            rxRead[uart] = 0;
+            rxRead[UARTSLOT(uart)] = 0;
+        }
+#ifdef SERIALDMARX
+        if (uart == SERIALDMARX) {
+            rxDmaConsumed++;
         }
+#endif // SERIALDMARX
         return c;
     } else {
         return 0;
@@ -391,32 +643,45 @@ uint8_t serialGet(uint8_t uart) {
 }
 
 uint8_t serialRxBufferFull(uint8_t uart) {
-    if (uart >= UART_COUNT) {
+    if (!UARTVALID(uart)) {
         return 0;
     }
 
-    return (((rxWrite[uart] + 1) == rxRead[uart])
-            || ((rxRead[uart] == 0) && ((rxWrite[uart] + 1) == RX_BUFFER_SIZE)));
+    serialReceiveSync(uart);
+
+    return (((rxWrite[UARTSLOT(uart)] + 1) == rxRead[UARTSLOT(uart)])
+            || ((rxRead[UARTSLOT(uart)] == 0) && ((rxWrite[UARTSLOT(uart)] + 1) == RX_BUFFER_SIZE)));
 }
 
 uint8_t serialRxBufferEmpty(uint8_t uart) {
-    if (uart >= UART_COUNT) {
+    if (!UARTVALID(uart)) {
         return 0;
     }
 
-    if (rxRead[uart] != rxWrite[uart]) {
+    serialReceiveSync(uart);
+
+    if (rxRead[UARTSLOT(uart)] != rxWrite[UARTSLOT(uart)]) {
         return 0;
     } else {
         return 1;
     }
 }
 
+uint16_t serialRxOverruns(uint8_t uart) {
+    if (!UARTVALID(uart)) {
+        return 0;
+    }
+
+    serialReceiveSync(uart);
+    return rxOverruns[UARTSLOT(uart)];
+}
+
 // ----------------------
 // |    Transmission    |
 // ----------------------
 
 void serialWrite(uint8_t uart, uint8_t data) {
-    if (uart >= UART_COUNT) {
+    if (!UARTVALID(uart)) {
         return;
     }
 
@@ -427,60 +692,105 @@ void serialWrite(uint8_t uart, uint8_t data) {
 #endif
     while (serialTxBufferFull(uart));
 
-    txBuffer[uart][txWrite[uart]] = data;
-    if (txWrite[uart] < (TX_BUFFER_SIZE - 1)) {
-        txWrite[uart]++;
+    txBuffer[UARTSLOT(uart)][txWrite[UARTSLOT(uart)]] = data;
+    if (txWrite[UARTSLOT(uart)] < (TX_BUFFER_SIZE - 1)) {
+        txWrite[UARTSLOT(uart)]++;
     } else {
-        txWrite[uart] = 0;
+        txWrite[UARTSLOT(uart)] = 0;
     }
-    if (shouldStartTransmission[uart]) {
-        shouldStartTransmission[uart] = 0;
-
-#ifndef UART_XMEGA
-        // Enable Interrupt
-        *serialRegisters[uart][SERIALB] |= (1 << serialBits[uart][SERIALUDRIE]);
-
-        // Trigger Interrupt
-        *serialRegisters[uart][SERIALA] |= (1 << serialBits[uart][SERIALUDRE]);
-#else // UART_XMEGA
-        // Enable Interrupt
-        serialRegisters[uart]->CTRLA |= UART_INTERRUPT_LEVEL_TX << 2; // TXCINTLVL
-
-        // Trigger Interrupt
-        serialTransmitInterrupt(uart);
-#endif // UART_XMEGA
+    if (shouldStartTransmission[UARTSLOT(uart)]) {
+        shouldStartTransmission[UARTSLOT(uart)] = 0;
+        serialStartTransmission(uart);
     }
 }
 
 void serialWriteString(uint8_t uart, const char *data) {
-    if (uart >= UART_COUNT) {
+    if (!UARTVALID(uart)) {
         return;
     }
 
     if (data == 0) {
-        serialWriteString(uart, "NULL");
+        serialWriteLiteral(uart, "NULL");
     } else {
-        while (*data != '\0') {
-            serialWrite(uart, *data++);
+        serialWriteBuffer(uart, (const uint8_t *)data, strlen(data));
+    }
+}
+
+static void serialWriteBytes(uint8_t uart, const uint8_t *data, uint16_t len,
+        uint8_t translate) {
+    if (!UARTVALID(uart)) {
+        return;
+    }
+
+#ifdef SERIALINJECTCR
+    uint8_t injectedCR = 0;
+#endif // SERIALINJECTCR
+
+    while (len > 0) {
+        // Free space in the ring buffer, up to its end
+        uint16_t read = txRead[UARTSLOT(uart)];
+        uint16_t write = txWrite[UARTSLOT(uart)];
+        uint16_t space;
+        if (read > write) {
+            space = read - write - 1;
+        } else if (read == 0) {
+            space = TX_BUFFER_SIZE - write - 1;
+        } else {
+            space = TX_BUFFER_SIZE - write;
+        }
+
+        // Copy as much as fits into this contiguous span
+        volatile uint8_t *dst = &txBuffer[UARTSLOT(uart)][write];
+        uint16_t used = 0;
+        while ((len > 0) && (used < space)) {
+#ifdef SERIALINJECTCR
+            if (translate && (*data == '\n') && (!injectedCR)) {
+                dst[used++] = '\r';
+                injectedCR = 1;
+                continue;
+            }
+            injectedCR = 0;
+#endif // SERIALINJECTCR
+            dst[used++] = *data++;
+            len--;
+        }
+
+        write += used;
+        if (write >= TX_BUFFER_SIZE) {
+            write = 0;
+        }
+        txWrite[UARTSLOT(uart)] = write;
+
+        if (shouldStartTransmission[UARTSLOT(uart)] && (used > 0)) {
+            shouldStartTransmission[UARTSLOT(uart)] = 0;
+            serialStartTransmission(uart);
         }
     }
 }
 
+void serialWriteBuffer(uint8_t uart, const uint8_t *data, uint16_t len) {
+    serialWriteBytes(uart, data, len, 1);
+}
+
+void serialWriteRaw(uint8_t uart, const uint8_t *data, uint16_t len) {
+    serialWriteBytes(uart, data, len, 0);
+}
+
 uint8_t serialTxBufferFull(uint8_t uart) {
-    if (uart >= UART_COUNT) {
+    if (!UARTVALID(uart)) {
         return 0;
     }
 
-    return (((txWrite[uart] + 1) == txRead[uart])
-            || ((txRead[uart] == 0) && ((txWrite[uart] + 1) == TX_BUFFER_SIZE)));
+    return (((txWrite[UARTSLOT(uart)] + 1) == txRead[UARTSLOT(uart)])
+            || ((txRead[UARTSLOT(uart)] == 0) && ((txWrite[UARTSLOT(uart)] + 1) == TX_BUFFER_SIZE)));
 }
 
 uint8_t serialTxBufferEmpty(uint8_t uart) {
-    if (uart >= UART_COUNT) {
+    if (!UARTVALID(uart)) {
         return 0;
     }
 
-    if (txRead[uart] != txWrite[uart]) {
+    if (txRead[UARTSLOT(uart)] != txWrite[UARTSLOT(uart)]) {
         return 0;
     } else {
         return 1;
@@ -491,46 +801,123 @@ uint8_t serialTxBufferEmpty(uint8_t uart) {
 // |      Internal      |
 // ----------------------
 
+#ifdef SERIALDMATX
+static void serialDmaTransmit(void) {
+    // Send everything up to txWrite, or up to the end of the ring buffer
+    uint16_t read = txRead[UARTSLOT(SERIALDMATX)];
+    uint16_t write = txWrite[UARTSLOT(SERIALDMATX)];
+    uint16_t len = (write >= read) ? (write - read) : (TX_BUFFER_SIZE - read);
+
+    txDmaLength = len;
+    if (len == 0) {
+        shouldStartTransmission[UARTSLOT(SERIALDMATX)] = 1;
+        return;
+    }
+
+    // Mark the transmission as incomplete until the last byte has left
+    serialRegisters[UARTID(SERIALDMATX)]->STATUS = USART_TXCIF_bm;
+    txDmaUnflushed = 1;
+
+    uint16_t src = (uint16_t)&txBuffer[UARTSLOT(SERIALDMATX)][read];
+    SERIALDMATXCHANNEL.SRCADDR0 = (src & 0x00FF);
+    SERIALDMATXCHANNEL.SRCADDR1 = (src & 0xFF00) >> 8;
+    SERIALDMATXCHANNEL.SRCADDR2 = 0x00;
+    SERIALDMATXCHANNEL.TRFCNT = len;
+    SERIALDMATXCHANNEL.CTRLA |= DMA_CH_ENABLE_bm;
+}
+#endif // SERIALDMATX
+
+static void serialReceiveSync(uint8_t uart) {
+#ifdef SERIALDMARX
+    if (uart != SERIALDMARX) {
+        return;
+    }
+
+    uint16_t count, blocks;
+    uint8_t sreg = SREG;
+    cli();
+    count = SERIALDMARXCHANNEL.TRFCNT;
+    blocks = rxDmaBlocks;
+    if (SERIALDMARXCHANNEL.CTRLB & DMA_CH_TRNIF_bm) {
+        // Buffer wrapped around, but the interrupt has not been serviced yet
+        count = SERIALDMARXCHANNEL.TRFCNT;
+        blocks++;
+    }
+    SREG = sreg;
+
+    rxDmaReceived = (blocks * RX_BUFFER_SIZE)
+            + ((RX_BUFFER_SIZE - count) & (RX_BUFFER_SIZE - 1));
+
+    // The DMA has overwritten bytes we did not read yet. Count and skip them,
+    // keeping only the most recent data.
+    uint16_t pending = rxDmaReceived - rxDmaConsumed;
+    if (pending > (RX_BUFFER_SIZE - 1)) {
+        uint16_t lost = pending - (RX_BUFFER_SIZE - 1);
+        if (rxOverruns[UARTSLOT(uart)] <= (0xFFFF - lost)) {
+            rxOverruns[UARTSLOT(uart)] += lost;
+        } else {
+            rxOverruns[UARTSLOT(uart)] = 0xFFFF;
+        }
+        rxDmaConsumed += lost;
+        rxRead[UARTSLOT(uart)] = rxDmaConsumed & (RX_BUFFER_SIZE - 1);
+    }
+
+    rxWrite[UARTSLOT(uart)] = rxDmaReceived & (RX_BUFFER_SIZE - 1);
+#endif // SERIALDMARX
+}
+
+static void serialStartTransmission(uint8_t uart) {
+#ifdef SERIALDMATX
+    if (uart == SERIALDMATX) {
+        serialDmaTransmit();
+        return;
+    }
+#endif // SERIALDMATX
+
+#ifndef UART_XMEGA
+    // Enable Interrupt
+    *serialRegisters[UARTID(uart)][SERIALB] |= (1 << serialBits[UARTID(uart)][SERIALUDRIE]);
+
+    // Trigger Interrupt
+    *serialRegisters[UARTID(uart)][SERIALA] |= (1 << serialBits[UARTID(uart)][SERIALUDRE]);
+#else // UART_XMEGA
+    // Enable Interrupt
+    serialRegisters[UARTID(uart)]->CTRLA |= UART_INTERRUPT_LEVEL_TX << 2; // TXCINTLVL
+
+    // Trigger Interrupt
+    serialTransmitInterrupt(uart);
+#endif // UART_XMEGA
+}
+
 static void serialReceiveInterrupt(uint8_t uart) {
 #ifndef UART_XMEGA
-    rxBuffer[uart][rxWrite[uart]] = *serialRegisters[uart][SERIALDATA];
+    rxBuffer[UARTSLOT(uart)][rxWrite[UARTSLOT(uart)]] = *serialRegisters[UARTID(uart)][SERIALDATA];
 #else // UART_XMEGA
-    rxBuffer[uart][rxWrite[uart]] = serialRegisters[uart]->DATA;
+    rxBuffer[UARTSLOT(uart)][rxWrite[UARTSLOT(uart)]] = serialRegisters[UARTID(uart)]->DATA;
 #endif // UART_XMEGA
 
-    // Simply skip increasing the write pointer if the receive buffer is overflowing
+    // Skip increasing the write pointer if the receive buffer is overflowing
     if (!serialRxBufferFull(uart)) {
-        if (rxWrite[uart] < (RX_BUFFER_SIZE - 1)) {
-            rxWrite[uart]++;
+        if (rxWrite[UARTSLOT(uart)] < (RX_BUFFER_SIZE - 1)) {
+            rxWrite[UARTSLOT(uart)]++;
         } else {
-            rxWrite[uart] = 0;
+            rxWrite[UARTSLOT(uart)] = 0;
         }
+    } else if (rxOverruns[UARTSLOT(uart)] < 0xFFFF) {
+        rxOverruns[UARTSLOT(uart)]++;
     }
 
 #ifdef FLOWCONTROL
-    if (rxBufferElements[uart] < 0xFFFF) {
-        rxBufferElements[uart]++;
+    if (rxBufferElements[UARTSLOT(uart)] < 0xFFFF) {
+        rxBufferElements[UARTSLOT(uart)]++;
     }
 
-    if ((flow[uart] == 1) && (rxBufferElements[uart] >= (RX_BUFFER_SIZE - FLOWMARK))) {
-        sendThisNext[uart] = XOFF;
-        flow[uart] = 0;
-        if (shouldStartTransmission[uart]) {
-            shouldStartTransmission[uart] = 0;
-
-#ifndef UART_XMEGA
-            // Enable Interrupt
-            *serialRegisters[uart][SERIALB] |= (1 << serialBits[uart][SERIALUDRIE]);
-
-            // Trigger Interrupt
-            *serialRegisters[uart][SERIALA] |= (1 << serialBits[uart][SERIALUDRE]);
-#else // UART_XMEGA
-            // Enable Interrupt
-            serialRegisters[uart]->CTRLA |= UART_INTERRUPT_LEVEL_TX << 2; // TXCINTLVL
-
-            // Trigger Interrupt
-            serialTransmitInterrupt(uart);
-#endif // UART_XMEGA
+    if ((flow[UARTSLOT(uart)] == 1) && (rxBufferElements[UARTSLOT(uart)] >= (RX_BUFFER_SIZE - FLOWMARK))) {
+        sendThisNext[UARTSLOT(uart)] = XOFF;
+        flow[UARTSLOT(uart)] = 0;
+        if (shouldStartTransmission[UARTSLOT(uart)]) {
+            shouldStartTransmission[UARTSLOT(uart)] = 0;
+            serialStartTransmission(uart);
         }
     }
 #endif // FLOWCONTROL
@@ -538,34 +925,34 @@ static void serialReceiveInterrupt(uint8_t uart) {
 
 static void serialTransmitInterrupt(uint8_t uart) {
 #ifdef FLOWCONTROL
-    if (sendThisNext[uart]) {
+    if (sendThisNext[UARTSLOT(uart)]) {
 #ifndef UART_XMEGA
-        *serialRegisters[uart][SERIALDATA] = sendThisNext[uart];
+        *serialRegisters[UARTID(uart)][SERIALDATA] = sendThisNext[UARTSLOT(uart)];
 #else // UART_XMEGA
-        serialRegisters[uart]->DATA = sendThisNext[uart];
+        serialRegisters[UARTID(uart)]->DATA = sendThisNext[UARTSLOT(uart)];
 #endif // UART_XMEGA
-        sendThisNext[uart] = 0;
+        sendThisNext[UARTSLOT(uart)] = 0;
     } else {
 #endif // FLOWCONTROL
-        if (txRead[uart] != txWrite[uart]) {
+        if (txRead[UARTSLOT(uart)] != txWrite[UARTSLOT(uart)]) {
 #ifndef UART_XMEGA
-            *serialRegisters[uart][SERIALDATA] = txBuffer[uart][txRead[uart]];
+            *serialRegisters[UARTID(uart)][SERIALDATA] = txBuffer[UARTSLOT(uart)][txRead[UARTSLOT(uart)]];
 #else // UART_XMEGA
-            serialRegisters[uart]->DATA = txBuffer[uart][txRead[uart]];
+            serialRegisters[UARTID(uart)]->DATA = txBuffer[UARTSLOT(uart)][txRead[UARTSLOT(uart)]];
 #endif // UART_XMEGA
-            if (txRead[uart] < (TX_BUFFER_SIZE -1)) {
-                txRead[uart]++;
+            if (txRead[UARTSLOT(uart)] < (TX_BUFFER_SIZE -1)) {
+                txRead[UARTSLOT(uart)]++;
             } else {
-                txRead[uart] = 0;
+                txRead[UARTSLOT(uart)] = 0;
             }
         } else {
-            shouldStartTransmission[uart] = 1;
+            shouldStartTransmission[UARTSLOT(uart)] = 1;
 
             // Disable Interrupt
 #ifndef UART_XMEGA
-            *serialRegisters[uart][SERIALB] &= ~(1 << serialBits[uart][SERIALUDRIE]);
+            *serialRegisters[UARTID(uart)][SERIALB] &= ~(1 << serialBits[UARTID(uart)][SERIALUDRIE]);
 #else // UART_XMEGA
-            serialRegisters[uart]->CTRLA &= ~(UART_INTERRUPT_MASK << 2); // TXCINTLVL
+            serialRegisters[UARTID(uart)]->CTRLA &= ~(UART_INTERRUPT_MASK << 2); // TXCINTLVL
 #endif // UART_XMEGA
         }
 #ifdef FLOWCONTROL
@@ -573,6 +960,33 @@ static void serialTransmitInterrupt(uint8_t uart) {
 #endif // FLOWCONTROL
 }
 
+#ifdef SERIALDMATX
+ISR(SERIALDMATXINTERRUPT) {
+    // Chunk has been sent, clear flag and free its space in the ring buffer
+    SERIALDMATXCHANNEL.CTRLB = DMA_CH_TRNIF_bm
+            | (UART_INTERRUPT_LEVEL_TX << DMA_CH_TRNINTLVL_gp);
+
+    uint16_t read = txRead[UARTSLOT(SERIALDMATX)] + txDmaLength;
+    if (read >= TX_BUFFER_SIZE) {
+        read -= TX_BUFFER_SIZE;
+    }
+    txRead[UARTSLOT(SERIALDMATX)] = read;
+
+    // Continue with the data written in the meantime, if any
+    serialDmaTransmit();
+}
+#endif // SERIALDMATX
+
+#ifdef SERIALDMARX
+ISR(SERIALDMARXINTERRUPT) {
+    // Another pass over the whole RX buffer has been completed
+    SERIALDMARXCHANNEL.CTRLB = DMA_CH_TRNIF_bm
+            | (UART_INTERRUPT_LEVEL_RX << DMA_CH_TRNINTLVL_gp);
+    rxDmaBlocks++;
+}
+#endif // SERIALDMARX
+
+#if UARTUSED(0)
 ISR(SERIALRECIEVEINTERRUPT) {
     // Receive complete
     serialReceiveInterrupt(0);
@@ -582,8 +996,9 @@ ISR(SERIALTRANSMITINTERRUPT) {
     // Data register empty
     serialTransmitInterrupt(0);
 }
+#endif
 
-#if UART_COUNT > 1
+#if UARTUSED(1)
 ISR(SERIALRECIEVEINTERRUPT1) {
     // Receive complete
     serialReceiveInterrupt(1);
@@ -595,7 +1010,7 @@ ISR(SERIALTRANSMITINTERRUPT1) {
 }
 #endif
 
-#if UART_COUNT > 2
+#if UARTUSED(2)
 ISR(SERIALRECIEVEINTERRUPT2) {
     // Receive complete
     serialReceiveInterrupt(2);
@@ -607,7 +1022,7 @@ ISR(SERIALTRANSMITINTERRUPT2) {
 }
 #endif
 
-#if UART_COUNT > 3
+#if UARTUSED(3)
 ISR(SERIALRECIEVEINTERRUPT3) {
     // Receive complete
     serialReceiveInterrupt(3);
@@ -619,7 +1034,7 @@ ISR(SERIALTRANSMITINTERRUPT3) {
 }
 #endif
 
-#if UART_COUNT > 4
+#if UARTUSED(4)
 ISR(SERIALRECIEVEINTERRUPT4) {
     // Receive complete
     serialReceiveInterrupt(4);
@@ -631,7 +1046,7 @@ ISR(SERIALTRANSMITINTERRUPT4) {
 }
 #endif
 
-#if UART_COUNT > 5
+#if UARTUSED(5)
 ISR(SERIALRECIEVEINTERRUPT5) {
     // Receive complete
     serialReceiveInterrupt(5);
@@ -643,7 +1058,7 @@ ISR(SERIALTRANSMITINTERRUPT5) {
 }
 #endif
 
-#if UART_COUNT > 6
+#if UARTUSED(6)
 ISR(SERIALRECIEVEINTERRUPT6) {
     // Receive complete
     serialReceiveInterrupt(6);
@@ -655,7 +1070,7 @@ ISR(SERIALTRANSMITINTERRUPT6) {
 }
 #endif
 
-#if UART_COUNT > 7
+#if UARTUSED(7)
 ISR(SERIALRECIEVEINTERRUPT7) {
     // Receive complete
     serialReceiveInterrupt(7);
@@ -0,0 +1,160 @@
+/*
+ * task.c
+ * avr_pump_board
+ *
+ * Each task has a ready flag, set from interrupts or other tasks, and an
+ * optional period. A single software timer wakes the main loop for the
+ * next periodic task, so idle periods are spent sleeping.
+ * The cycles spent in each task are counted with the system timebase.
+ *
+ * Copyright (c) 2017 Thomas Buck <xythobuz@xythobuz.de>
+ * All rights reserved.
+ */
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "clock.h"
+#include "idle.h"
+#include "task.h"
+
+#define CYCLES_PER_MS (F_CPU / 1000ul)
+
+typedef struct {
+    TaskFunction function;
+    uint32_t period; // ms, 0 if not periodic
+    uint64_t due; // next periodic run, ms since reset
+} Task;
+
+static Task tasks[TASK_COUNT];
+static TaskStatistics taskStats[TASK_COUNT];
+volatile static uint8_t taskFlags = 0;
+
+static uint8_t taskTimer = TIMER_INVALID;
+static uint64_t taskTimerDue = 0;
+static uint64_t taskSince = 0;
+
+void taskRegister(uint8_t id, const char *name, TaskFunction function) {
+    if (id >= TASK_COUNT) {
+        return;
+    }
+
+    tasks[id].function = function;
+    tasks[id].period = 0;
+    taskStats[id].name = name;
+}
+
+void taskReady(uint8_t id) {
+    if (id >= TASK_COUNT) {
+        return;
+    }
+
+    uint8_t sreg = SREG;
+    cli();
+    taskFlags |= 1 << id;
+    idleWake();
+    SREG = sreg;
+}
+
+static void taskTimerExpired(void) {
+    taskTimer = TIMER_INVALID;
+    idleWake();
+}
+
+// keep the timer on the earliest periodic deadline
+static void taskArm(void) {
+    uint64_t next = 0;
+    for (uint8_t i = 0; i < TASK_COUNT; i++) {
+        if ((tasks[i].period != 0) && ((next == 0) || (tasks[i].due < next))) {
+            next = tasks[i].due;
+        }
+    }
+
+    if ((taskTimer != TIMER_INVALID) && (next == taskTimerDue)) {
+        return;
+    }
+
+    timerCancel(taskTimer);
+    taskTimer = TIMER_INVALID;
+    taskTimerDue = next;
+    if (next == 0) {
+        return;
+    }
+
+    uint64_t now = getSystemTime();
+    taskTimer = timerStart((next > now) ? (next - now) : 0, taskTimerExpired, 0);
+}
+
+void taskSchedule(uint8_t id, uint32_t period) {
+    if (id >= TASK_COUNT) {
+        return;
+    }
+
+    tasks[id].period = period;
+    tasks[id].due = getSystemTime() + period;
+    taskArm();
+}
+
+static void taskRun(uint8_t id) {
+    uint32_t start = getSystemCycles();
+    tasks[id].function();
+    uint32_t cycles = getSystemCycles() - start;
+
+    taskStats[id].runs++;
+    taskStats[id].cycles += cycles;
+    if (cycles > taskStats[id].maxCycles) {
+        taskStats[id].maxCycles = cycles;
+    }
+}
+
+void taskLoop(void) {
+    uint64_t now = getSystemTime();
+    for (uint8_t i = 0; i < TASK_COUNT; i++) {
+        if ((tasks[i].period != 0) && (tasks[i].due <= now)) {
+            taskReady(i);
+
+            // skip runs that were missed instead of catching up
+            tasks[i].due += tasks[i].period;
+            if (tasks[i].due <= now) {
+                tasks[i].due = now + tasks[i].period;
+            }
+        }
+    }
+
+    for (uint8_t i = 0; i < TASK_COUNT; i++) {
+        uint8_t sreg = SREG;
+        cli();
+        uint8_t ready = taskFlags & (1 << i);
+        taskFlags &= ~(1 << i);
+        SREG = sreg;
+
+        if (ready && (tasks[i].function != NULL)) {
+            taskRun(i);
+        }
+    }
+
+    taskArm();
+}
+
+uint64_t taskStatistics(TaskStatistics *stats, uint8_t reset) {
+    uint64_t now = getSystemTime();
+    uint64_t elapsed = (now - taskSince) * CYCLES_PER_MS;
+
+    for (uint8_t i = 0; i < TASK_COUNT; i++) {
+        stats[i] = taskStats[i];
+
+        if (reset) {
+            taskStats[i].runs = 0;
+            taskStats[i].cycles = 0;
+            taskStats[i].maxCycles = 0;
+        }
+    }
+
+    if (reset) {
+        taskSince = now;
+    }
+    return elapsed;
+}
+
@@ -0,0 +1,90 @@
+/*
+ * cobs_roundtrip.c
+ * avr_pump_board
+ *
+ * Host test of the COBS framing and the CRC16 of the binary protocol.
+ * Random buffers, some made of zero bytes only, some without any, have to
+ * survive encoding and in-place decoding unchanged.
+ *
+ * Copyright (c) 2017 Thomas Buck <xythobuz@xythobuz.de>
+ * All rights reserved.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cobs.h"
+
+#define ROUNDS 200000
+#define MAX_LENGTH 700
+
+static uint32_t errors = 0;
+
+static void fail(const char *what, uint16_t len) {
+    if (errors++ < 10) {
+        printf("FAIL: %s (%d bytes)\n", what, len);
+    }
+}
+
+static uint8_t randomByte(uint8_t kind) {
+    switch (kind) {
+        case 0:
+            return 0;
+        case 1:
+            return (rand() % 2) ? 0 : (rand() % 256);
+        default:
+            return (rand() % 255) + 1;
+    }
+}
+
+int main(void) {
+    // Check value of CRC-16/XMODEM
+    uint16_t crc = crc16((const uint8_t *)"123456789", 9);
+    if (crc != 0x31C3) {
+        printf("FAIL: crc16(\"123456789\") is 0x%04X, not 0x31C3\n", crc);
+        errors++;
+    }
+
+    uint8_t src[MAX_LENGTH];
+    uint8_t buf[COBS_ENCODED_SIZE(MAX_LENGTH)];
+    srand(1);
+
+    for (uint32_t r = 0; r < ROUNDS; r++) {
+        uint16_t len = rand() % MAX_LENGTH;
+        uint8_t kind = rand() % 4;
+        for (uint16_t i = 0; i < len; i++) {
+            src[i] = randomByte(kind);
+        }
+
+        uint16_t n = cobsEncode(src, len, buf);
+        if (n > COBS_ENCODED_SIZE(len)) {
+            fail("encoded size above COBS_ENCODED_SIZE", len);
+        }
+        if (memchr(buf, 0, n) != NULL) {
+            fail("zero byte in encoded data", len);
+        }
+
+        // Nothing to compare for empty frames, those decode to length 0
+        uint16_t m = cobsDecode(buf, n, buf);
+        if ((len > 0) && ((m != len) || (memcmp(buf, src, len) != 0))) {
+            fail("decoded data differs", len);
+        }
+    }
+
+    // Code byte pointing past the end of the frame
+    static const uint8_t truncated[] = { 5, 1, 2 };
+    if (cobsDecode(truncated, sizeof(truncated), buf) != 0) {
+        printf("FAIL: truncated frame accepted\n");
+        errors++;
+    }
+
+    if (errors > 0) {
+        printf("cobs_roundtrip: FAILED\n");
+        return 1;
+    }
+
+    printf("cobs_roundtrip: OK\n");
+    return 0;
+}
+
@@ -0,0 +1,217 @@
+/*
+ * interface_fuzz.c
+ * avr_pump_board
+ *
+ * Host fuzz and throughput test of the serial ASCII interface parser. The
+ * serial driver and the modules behind the commands are replaced by stubs,
+ * so only interface.c is exercised.
+ *
+ * First, random bytes are fed to the parser, which must neither crash nor
+ * reach an invalid state. Then, in machine mode, random lines made of
+ * command characters, numbers and noise must be answered with exactly one
+ * OK or ERR reply each. Finally the time per byte for a typical recipe line
+ * is measured.
+ *
+ * Copyright (c) 2017 Thomas Buck <xythobuz@xythobuz.de>
+ * All rights reserved.
+ */
+
+#include <stdlib.h>
+#include <time.h>
+
+#include "interface_sim.h"
+
+#define RANDOM_ROUNDS 20
+#define LINE_ROUNDS 200000
+#define SPEED_ROUNDS 20
+
+// ----------------------------------------------------------------------------
+// Recipe module, with the range checks the parser relies on
+
+static uint32_t lastPump = 0;
+
+uint8_t recipePump(uint32_t pump) {
+    calls++;
+    lastPump = pump;
+    return ((pump < 1) || (pump > 20)) ? STATUS_INVALID_PUMP : STATUS_OK;
+}
+
+uint8_t recipeDuration(uint32_t time) {
+    calls++;
+    return (time == 0) ? STATUS_INVALID_TIME : STATUS_OK;
+}
+
+uint8_t recipeSelect(uint32_t slot) {
+    calls++;
+    return (slot >= RECIPE_SLOTS) ? STATUS_INVALID_PARAMETER : STATUS_OK;
+}
+
+uint8_t recipeAlign(uint32_t align) {
+    calls++;
+    return (align > 2) ? STATUS_INVALID_PARAMETER : STATUS_OK;
+}
+
+uint8_t recipeDelay(uint32_t delay) { calls++; return STATUS_OK; }
+uint8_t recipeStore(void) { calls++; return STATUS_OK; }
+uint8_t recipeGo(void) { calls++; return STATUS_OK; }
+uint8_t recipeReset(void) { calls++; return STATUS_OK; }
+uint8_t recipeList(void) { calls++; return STATUS_OK; }
+uint8_t recipeCount(void) { return 1; }
+uint8_t recipeSelected(void) { return 0; }
+
+// Random line without commands that leave machine mode or the ASCII menu
+static uint32_t randomLines(uint32_t count) {
+    static const char alphabet[] = "kKrRpPdDwWjJsSgGtTaAlLcCeEnNfFhHvViIuUqQ?"
+            "SONPWYZyzo";
+
+    inputLength = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        simAppend(COMMAND_PREFIX);
+
+        uint8_t len = rand() % 24;
+        for (uint8_t j = 0; (j < len) && (inputLength < (INPUT_SIZE - 1)); j++) {
+            uint8_t r = rand() % 16;
+            if (r < 7) {
+                input[inputLength++] = alphabet[rand() % (sizeof(alphabet) - 1)];
+            } else if (r < 14) {
+                input[inputLength++] = '0' + (rand() % 10);
+            } else {
+                uint8_t c = rand() % 256;
+                if ((c == '\n') || (c == 'm') || (c == 'b') || (c == 'x')
+                        || (c == 'M') || (c == 'B') || (c == 'X')) {
+                    c = '\r';
+                }
+                input[inputLength++] = c;
+            }
+        }
+        simAppend("\n");
+    }
+    return count;
+}
+
+int main(void) {
+    uint32_t errors = 0;
+    srand(1);
+
+    // Random bytes, with many command characters and new-lines
+    for (uint8_t r = 0; r < RANDOM_ROUNDS; r++) {
+        for (inputLength = 0; inputLength < INPUT_SIZE; inputLength++) {
+            uint8_t k = rand() % 10;
+            if (k < 5) {
+                input[inputLength] = "pdwsgrlncfkejta"[rand() % 15];
+            } else if (k < 9) {
+                input[inputLength] = '0' + (rand() % 10);
+            } else {
+                input[inputLength] = (rand() % 3) ? '\n' : (rand() % 256);
+            }
+        }
+        simFeed();
+    }
+
+    // Machine mode, one reply per line
+    inputLength = 0;
+    simAppend("\n" COMMAND_PREFIX "m1\n");
+    simFeed();
+
+    replies = 0;
+    uint32_t lines = 0;
+    for (uint32_t r = 0; r < LINE_ROUNDS; r += 1000) {
+        lines += randomLines(1000);
+        simFeed();
+    }
+    if (replies != lines) {
+        printf("FAIL: %lu replies to %lu lines\n", (unsigned long)replies,
+                (unsigned long)lines);
+        errors++;
+    }
+    if (invalidStates > 0) {
+        printf("FAIL: parser reached an invalid state %lu times\n",
+                (unsigned long)invalidStates);
+        errors++;
+    }
+
+    // The pump set of n is named with an upper case M, m is the mode command
+    inputLength = 0;
+    replies = 0;
+    simAppend(COMMAND_PREFIX "n2M12\n");
+    simFeed();
+    if ((replies != 1) || (switchedOn != 0x0E)) {
+        printf("FAIL: n2M12 switched on 0x%lX\n", (unsigned long)switchedOn);
+        errors++;
+    }
+
+    // The names of c do not collide with the lower case commands
+    inputLength = 0;
+    replies = 0;
+    simAppend(COMMAND_PREFIX "c1M3S20O100N2P50\n");
+    simFeed();
+    if ((replies != 1) || (cleanConfig.mask != 3) || (cleanConfig.stagger != 20)
+            || (cleanConfig.onTime != 100) || (cleanConfig.cycles != 2)
+            || (cleanConfig.pause != 50)) {
+        printf("FAIL: c1M3S20O100N2P50 not parsed\n");
+        errors++;
+    }
+
+    // The names of e do not hide the pump command
+    inputLength = 0;
+    replies = 0;
+    simAppend(COMMAND_PREFIX "e10p3d100g\n");
+    simFeed();
+    if ((replies != 1) || (strncmp(lastReply, "OK", 2) != 0) || (lastBudget != 10)
+            || (lastPump != 3)) {
+        printf("FAIL: e10p3d100g replied %s\n", lastReply);
+        errors++;
+    }
+    inputLength = 0;
+    replies = 0;
+    simAppend(COMMAND_PREFIX "e12P3W4\n");
+    simFeed();
+    if ((replies != 1) || (strcmp(lastReply, "OK") != 0) || (lastBudget != 12)
+            || (lastWeight[2] != 4)) {
+        printf("FAIL: e12P3W4 replied %s\n", lastReply);
+        errors++;
+    }
+
+    // A new baudrate is confirmed by the next line, not by the one switching
+    uint32_t oldRate = baudRate;
+    inputLength = 0;
+    simAppend(COMMAND_PREFIX "b10000v\n");
+    simFeed();
+    simTime += BAUDRATE_FALLBACK_TIMEOUT + 1;
+    interfaceLoop();
+    if (baudRate != oldRate) {
+        printf("FAIL: b10000v confirmed its own baudrate\n");
+        errors++;
+    }
+    inputLength = 0;
+    simAppend(COMMAND_PREFIX "b10000\n" COMMAND_PREFIX "v\n");
+    simFeed();
+    simTime += BAUDRATE_FALLBACK_TIMEOUT + 1;
+    interfaceLoop();
+    if (baudRate != 1000000) {
+        printf("FAIL: b10000 not confirmed by the next line\n");
+        errors++;
+    }
+
+    // Throughput for typical recipe lines
+    inputLength = 0;
+    while (inputLength < (INPUT_SIZE - 64)) {
+        simAppend(COMMAND_PREFIX "rp3d1500p7d800w200p12d250g\n");
+    }
+    clock_t start = clock();
+    for (uint8_t r = 0; r < SPEED_ROUNDS; r++) {
+        simFeed();
+    }
+    double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+    printf("%lu module calls, %.1f ns/byte\n", (unsigned long)calls,
+            seconds * 1e9 / ((double)SPEED_ROUNDS * inputLength));
+
+    if (errors > 0) {
+        printf("interface_fuzz: FAILED\n");
+        return 1;
+    }
+
+    printf("interface_fuzz: OK\n");
+    return 0;
+}
+
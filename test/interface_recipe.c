@@ -0,0 +1,85 @@
+/*
+ * interface_recipe.c
+ * avr_pump_board
+ *
+ * Host test of recipe lines, from the parser in interface.c through the
+ * real recipe.c down to the recipe handed to the pumps module. The example
+ * lines of the interface documentation have to dispense what they say.
+ *
+ * Copyright (c) 2017 Thomas Buck <xythobuz@xythobuz.de>
+ * All rights reserved.
+ */
+
+#include "interface_sim.h"
+
+typedef struct {
+    const char *line;
+    const char *reply; // start of the expected reply
+    uint8_t count; // ingredients dispensed
+    RecipeIngredient ingredients[3];
+} RecipeLine;
+
+static const RecipeLine lines[] = {
+    // stored by p with d and w, s afterwards changes nothing
+    { "rp3d1500w0sp7d800w200sg", "OK", 2, { { 3, 1500, 0 }, { 7, 800, 200 } } },
+    { "rp3d1500p7d800w200g", "OK", 2, { { 3, 1500, 0 }, { 7, 800, 200 } } },
+    { "rp3d1500p7d800w200sg", "OK", 2, { { 3, 1500, 0 }, { 7, 800, 200 } } },
+
+    // the duration carries over to the next ingredient, the delay does not
+    { "rp3d1500w100sp4sg", "OK", 2, { { 3, 1500, 100 }, { 4, 1500, 0 } } },
+    { "rp3d1500p4w50sg", "OK", 2, { { 3, 1500, 0 }, { 4, 1500, 50 } } },
+
+    // a pump stored again is overwritten
+    { "rp3d1500p3d700sg", "OK", 1, { { 3, 700, 0 } } },
+
+    // the slot keeps its recipe after go
+    { "g", "OK", 1, { { 3, 700, 0 } } },
+
+    { "rp3sg", "ERR", 0 },
+    { "rg", "ERR", 0 },
+};
+
+int main(void) {
+    uint32_t errors = 0;
+
+    simAppend("\n" COMMAND_PREFIX "m1\n");
+    simFeed();
+
+    for (uint8_t i = 0; i < (sizeof(lines) / sizeof(lines[0])); i++) {
+        const RecipeLine *l = &lines[i];
+        inputLength = 0;
+        replies = 0;
+        dispensedCount = 0;
+        simAppend(COMMAND_PREFIX);
+        simAppend(l->line);
+        simAppend("\n");
+        simFeed();
+
+        uint8_t ok = (replies == 1) && (strncmp(lastReply, l->reply, strlen(l->reply)) == 0)
+                && (dispensedCount == l->count);
+        for (uint8_t j = 0; ok && (j < l->count); j++) {
+            ok = (dispensed[j].pump == l->ingredients[j].pump)
+                    && (dispensed[j].time == l->ingredients[j].time)
+                    && (dispensed[j].delay == l->ingredients[j].delay);
+        }
+
+        if (!ok) {
+            printf("FAIL: %s replied %s, dispensed", l->line, lastReply);
+            for (uint8_t j = 0; j < dispensedCount; j++) {
+                printf(" p%dd%luw%lu", dispensed[j].pump, (unsigned long)dispensed[j].time,
+                        (unsigned long)dispensed[j].delay);
+            }
+            printf("\n");
+            errors++;
+        }
+    }
+
+    if (errors > 0) {
+        printf("interface_recipe: FAILED\n");
+        return 1;
+    }
+
+    printf("interface_recipe: OK\n");
+    return 0;
+}
+
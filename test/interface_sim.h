@@ -0,0 +1,206 @@
+/*
+ * interface_sim.h
+ * avr_pump_board
+ *
+ * Stand-ins for the serial driver and the modules behind the commands of
+ * the ASCII interface, for the host tests of interface.c. Include it in the
+ * test, which still has to provide the recipe functions or link recipe.c.
+ *
+ * Input is fed to the parser from a buffer, the replies of machine mode are
+ * counted and the last one is kept. The stubs record the values they were
+ * called with, so the parsed parameters can be checked.
+ *
+ * Copyright (c) 2017 Thomas Buck <xythobuz@xythobuz.de>
+ * All rights reserved.
+ */
+
+#ifndef _interface_sim_h
+#define _interface_sim_h
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "config.h"
+#include "status.h"
+#include "clock.h"
+#include "serial.h"
+#include "recipe.h"
+#include "pumps.h"
+#include "lights.h"
+#include "protocol.h"
+#include "interface.h"
+#include "idle.h"
+#include "task.h"
+
+#define INPUT_SIZE (1024UL * 1024UL)
+
+static uint8_t input[INPUT_SIZE];
+static uint32_t inputLength = 0;
+static uint32_t inputPosition = 0;
+
+static char outputLine[256];
+static char lastReply[256];
+static uint16_t outputLength = 0;
+static uint32_t replies = 0;
+static uint32_t invalidStates = 0;
+static uint32_t calls = 0;
+
+// ----------------------------------------------------------------------------
+// Serial driver, input from the buffer above, replies are counted
+
+uint8_t serialHasChar(uint8_t uart) {
+    return inputPosition < inputLength;
+}
+
+uint8_t serialGet(uint8_t uart) {
+    return input[inputPosition++];
+}
+
+void serialWrite(uint8_t uart, uint8_t data) {
+    if (data == '\n') {
+        outputLine[outputLength] = '\0';
+        if ((strncmp(outputLine, "OK", 2) == 0) || (strncmp(outputLine, "ERR ", 4) == 0)) {
+            strcpy(lastReply, outputLine);
+            replies++;
+        }
+        if (strstr(outputLine, "Invalid State") != NULL) {
+            invalidStates++;
+        }
+        outputLength = 0;
+    } else if (outputLength < (sizeof(outputLine) - 1)) {
+        outputLine[outputLength++] = data;
+    }
+}
+
+void serialWriteBuffer(uint8_t uart, const uint8_t *data, uint16_t len) {
+    for (uint16_t i = 0; i < len; i++) {
+        serialWrite(uart, data[i]);
+    }
+}
+
+void serialWriteString(uint8_t uart, const char *data) {
+    serialWriteBuffer(uart, (const uint8_t *)data, strlen(data));
+}
+
+void serialWriteInt16(uint8_t uart, uint16_t num) {
+    serialWriteInt32(uart, num);
+}
+
+void serialWriteInt32(uint8_t uart, uint32_t num) {
+    char buf[11];
+    serialWriteBuffer(uart, (const uint8_t *)buf, sprintf(buf, "%lu", (unsigned long)num));
+}
+
+uint8_t serialBaudCalculate(uint32_t rate, SerialBaud *baud) {
+    memset(baud, 0, sizeof(SerialBaud));
+    baud->rate = rate;
+    return 0;
+}
+
+static uint32_t baudRate = 0;
+
+void serialSetBaud(uint8_t uart, const SerialBaud *baud) {
+    baudRate = baud->rate;
+}
+
+void serialFlush(uint8_t uart) { }
+
+// ----------------------------------------------------------------------------
+// Modules behind the commands
+
+static uint32_t switchedOn = 0;
+static PumpCleanConfig cleanConfig;
+static uint16_t lastBudget = 0;
+static uint8_t lastWeight[20];
+static RecipeIngredient dispensed[RECIPE_MAX_INGREDIENTS];
+static uint8_t dispensedCount = 0;
+
+uint8_t pumpsSwitch(uint32_t on, uint32_t off) {
+    calls++;
+    switchedOn = on;
+    return STATUS_OK;
+}
+
+uint8_t pumpsCleanStart(const PumpCleanConfig *config) {
+    calls++;
+    cleanConfig = *config;
+    return STATUS_OK;
+}
+
+uint8_t pumpsSetBudget(uint16_t budget, const uint8_t *weight) {
+    calls++;
+    lastBudget = budget;
+    memcpy(lastWeight, weight, sizeof(lastWeight));
+    return STATUS_OK;
+}
+
+uint8_t pumpsRecipe(uint8_t slot, const RecipeIngredient *recipe, uint8_t ingredients,
+        uint8_t align) {
+    calls++;
+    memcpy(dispensed, recipe, ingredients * sizeof(RecipeIngredient));
+    dispensedCount = ingredients;
+    return STATUS_OK;
+}
+
+uint8_t pumpsAbort(void) { calls++; return STATUS_OK; }
+uint8_t pumpsAbortSlot(uint8_t slot) { calls++; return STATUS_OK; }
+uint8_t pumpsCleanStop(void) { calls++; return STATUS_OK; }
+uint16_t pumpsBudget(void) { return 0; }
+uint8_t pumpsWeight(uint8_t pump) { return 1; }
+uint8_t pumpsSlots(void) { return 0; }
+uint32_t pumpsRunningMask(void) { return 0; }
+uint32_t pumpsRemaining(uint8_t pump) { return 0; }
+uint8_t pumpsFinished(uint8_t *slot) { return PUMPS_FINISHED_NONE; }
+
+uint8_t pumpsCleanProgress(PumpCleanProgress *progress) {
+    memset(progress, 0, sizeof(PumpCleanProgress));
+    return 0;
+}
+
+void idleStatistics(IdleStatistics *stats, uint8_t reset) {
+    memset(stats, 0, sizeof(IdleStatistics));
+}
+
+uint64_t taskStatistics(TaskStatistics *stats, uint8_t reset) {
+    for (uint8_t i = 0; i < TASK_COUNT; i++) {
+        memset(&stats[i], 0, sizeof(TaskStatistics));
+        stats[i].name = "task";
+    }
+    return 0;
+}
+
+uint8_t timerStart(uint32_t millis, TimerCallback callback, uint8_t flags) { return 0; }
+static uint64_t simTime = 0;
+
+uint64_t getSystemTime(void) {
+    return simTime;
+}
+
+void taskReady(uint8_t id) { }
+void lightsDisplayBuffer(void) { }
+void protocolStart(void) { }
+uint8_t protocolActive(void) { return 0; }
+void protocolLoop(void) { }
+void protocolEvent(uint8_t event, uint8_t slot) { }
+
+// ----------------------------------------------------------------------------
+
+static void simFeed(void) {
+    inputPosition = 0;
+    while (inputPosition < inputLength) {
+        interfaceLoop();
+    }
+
+    // print the prompt or start the next line
+    interfaceLoop();
+}
+
+static void simAppend(const char *s) {
+    while ((*s != '\0') && (inputLength < INPUT_SIZE)) {
+        input[inputLength++] = *s++;
+    }
+}
+
+#endif // _interface_sim_h
+
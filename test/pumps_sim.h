@@ -0,0 +1,172 @@
+/*
+ * pumps_sim.h
+ * avr_pump_board
+ *
+ * Simulation of the hardware around pumps.c for the host tests. Include it
+ * instead of pumps.c, and link schedule.c.
+ *
+ * Time advances in steps of one TCD0 tick (8us), counted in the 4MHz ticks
+ * of the system clock. The one-shot timer of clock.c is replaced by an ideal
+ * one that fires exactly at its deadline. TCD0 overflows copy the prepared
+ * block to the VPORTs when event channel 1 and DMA channel 0 are set up
+ * for it, like the DMA controller would. The pins of PORTA, PORTB and PORTH
+ * are the OUT registers of VPORT0 - VPORT2, OUTSET and OUTCLR are applied
+ * to them after every call into the firmware.
+ *
+ * simSample() is called whenever the pins may have changed, and records the
+ * time each pump was last switched on and off.
+ *
+ * Copyright (c) 2017 Thomas Buck <xythobuz@xythobuz.de>
+ * All rights reserved.
+ */
+
+#ifndef _pumps_sim_h
+#define _pumps_sim_h
+
+#include <stdint.h>
+
+#include "../src/pumps.c"
+
+#define SIM_TICKS_PER_MS 4000ul
+#define SIM_TICKS_PER_STEP (SIM_TICKS_PER_MS / PUMP_DMA_TICKS_PER_MS)
+
+static uint64_t simNow = 0; // 4MHz ticks
+static uint8_t simDmaFree = 1; // lights lend their DMA channel
+static uint8_t simDmaLent = 0;
+static uint32_t simLights = 0; // lights mirroring the pumps
+
+static uint64_t simDeadline = 0;
+static TimerCallback simCallback = NULL;
+static uint8_t simFiring = 0;
+
+static uint32_t simPins = 0;
+static uint64_t simOnAt[21];
+static uint64_t simOffAt[21];
+
+void serialWriteBuffer(uint8_t uart, const uint8_t *data, uint16_t len) { }
+void serialWriteInt16(uint8_t uart, uint16_t num) { }
+void serialWriteInt32(uint8_t uart, uint32_t num) { }
+void taskReady(uint8_t id) { }
+void taskSchedule(uint8_t id, uint32_t period) { }
+
+void lightsSetMask(uint32_t on, uint32_t off) {
+    simLights = (simLights & ~off) | on;
+}
+
+uint8_t lightsLendDMA(void) {
+    if (!simDmaFree || simDmaLent) {
+        return 0;
+    }
+    simDmaLent = 1;
+    return 1;
+}
+
+void lightsReturnDMA(void) {
+    simDmaLent = 0;
+}
+
+uint64_t getSystemTime(void) {
+    return simNow / SIM_TICKS_PER_MS;
+}
+
+uint32_t getSystemMicros(void) {
+    return simNow / (SIM_TICKS_PER_MS / 1000);
+}
+
+void preciseTimeFireIn(uint32_t millis, uint16_t micros, TimerCallback callback) {
+    uint64_t ticks = (((uint64_t)millis * 1000) + micros) * (SIM_TICKS_PER_MS / 1000);
+    simDeadline = (simFiring ? simDeadline : simNow) + ticks;
+    simCallback = callback;
+}
+
+void preciseTimeCancel(void) {
+    simCallback = NULL;
+}
+
+static void simApply(PORT_t *port, VPORT_t *vport) {
+    vport->OUT = (vport->OUT & ~port->OUTCLR) | port->OUTSET;
+    port->OUTCLR = 0;
+    port->OUTSET = 0;
+}
+
+// Pumps switched on at the pins, bit (n - 1) for pump n
+static uint32_t simPorts(void) {
+    simApply(&PORTA, &VPORT0);
+    simApply(&PORTB, &VPORT1);
+    simApply(&PORTH, &VPORT2);
+    return VPORT0.OUT | ((uint32_t)VPORT1.OUT << 8) | ((uint32_t)(VPORT2.OUT & 0x0F) << 16);
+}
+
+static void simSample(void) {
+    uint32_t pins = simPorts();
+    for (uint8_t p = 1; p <= 20; p++) {
+        uint32_t bit = PUMP_MASK(p);
+        if ((pins & bit) && !(simPins & bit)) {
+            simOnAt[p] = simNow;
+        } else if (!(pins & bit) && (simPins & bit)) {
+            simOffAt[p] = simNow;
+        }
+    }
+    simPins = pins;
+}
+
+static void simReset(void) {
+    simNow = 0;
+    simDmaLent = 0;
+    simLights = 0;
+    simCallback = NULL;
+    simPins = 0;
+    VPORT0.OUT = 0;
+    VPORT1.OUT = 0;
+    VPORT2.OUT = 0xA0; // the upper pins of PORTH are not ours
+    TCD0.CTRLA = TC_CLKSEL_OFF_gc;
+    DMA.CH0.CTRLA = 0;
+    pumpsInit();
+    simSample();
+}
+
+static void simTimerD0(void) {
+    if (TCD0.CTRLA == TC_CLKSEL_OFF_gc) {
+        return;
+    }
+
+    if (TCD0.CNT < TCD0.PER) {
+        TCD0.CNT++;
+        return;
+    }
+
+    TCD0.CNT = 0;
+    if ((EVSYS.CH1MUX == EVSYS_CHMUX_TCD0_OVF_gc) && (DMA.CH0.CTRLA & DMA_CH_ENABLE_bm)) {
+        simPorts();
+        VPORT0.OUT = pumpDmaBlock[0];
+        VPORT1.OUT = pumpDmaBlock[4];
+        VPORT2.OUT = pumpDmaBlock[8];
+        simSample();
+    }
+    TCD0.PER = TCD0.PERBUF;
+    TCD0_OVF_vect();
+    simSample();
+}
+
+// Advance the time by one TCD0 tick
+static void simStep(void) {
+    uint64_t end = simNow + SIM_TICKS_PER_STEP;
+
+    while ((simCallback != NULL) && (simDeadline <= end)) {
+        TimerCallback callback = simCallback;
+        simCallback = NULL;
+        if (simDeadline > simNow) {
+            simNow = simDeadline;
+        }
+        simFiring = 1;
+        callback();
+        simFiring = 0;
+        simSample();
+    }
+
+    simNow = end;
+    simTimerD0();
+}
+
+#endif // _pumps_sim_h
+
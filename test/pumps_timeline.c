@@ -0,0 +1,242 @@
+/*
+ * pumps_timeline.c
+ * avr_pump_board
+ *
+ * Host test of the timeline compiled by pumpsRecipe() for random recipes.
+ * The events have to be sorted, switch each pump of the recipe on once and
+ * off once, keep the durations and mark the end of the recipe. A second
+ * recipe started while the first one runs has to be merged without moving
+ * the events left of the first one. The recipe itself must not be changed,
+ * and the remaining time of a pump must never jump up while it runs.
+ *
+ * Copyright (c) 2017 Thomas Buck <xythobuz@xythobuz.de>
+ * All rights reserved.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pumps_sim.h"
+
+#define ROUNDS 1000
+
+static uint32_t errors = 0;
+
+static void fail(uint32_t round, const char *what) {
+    if (errors++ < 10) {
+        printf("FAIL: round %lu: %s\n", (unsigned long)round, what);
+    }
+}
+
+// Random ingredients using some of the pumps in available
+static uint8_t randomRecipe(RecipeIngredient *recipe, uint32_t available) {
+    uint8_t count = 0;
+    uint8_t chance = 1 + (rand() % 4);
+    for (uint8_t p = 1; (p <= 20) && (count < RECIPE_MAX_INGREDIENTS); p++) {
+        if ((available & PUMP_MASK(p)) && ((rand() % chance) == 0)) {
+            recipe[count].pump = p;
+            recipe[count].time = 1 + (rand() % 300);
+            recipe[count].delay = (rand() % 2) ? 0 : (rand() % 200);
+            count++;
+        }
+    }
+
+    if (count == 0) {
+        recipe[0].pump = __builtin_ctz(available) + 1;
+        recipe[0].time = 1 + (rand() % 300);
+        recipe[0].delay = 0;
+        count = 1;
+    }
+
+    // shuffle, the order of the ingredients should not matter
+    for (uint8_t i = count - 1; i > 0; i--) {
+        uint8_t j = rand() % (i + 1);
+        RecipeIngredient t = recipe[i];
+        recipe[i] = recipe[j];
+        recipe[j] = t;
+    }
+    return count;
+}
+
+// Checks the events of one recipe in the timeline, from event first on
+static void checkRecipe(uint32_t round, const RecipeIngredient *recipe, uint8_t count,
+        uint8_t slot, uint8_t first, uint8_t exactStart) {
+    for (uint8_t i = 0; i < count; i++) {
+        uint32_t bit = PUMP_MASK(recipe[i].pump);
+        int16_t on = -1, off = -1;
+        for (uint8_t e = first; e < pumpEventCount; e++) {
+            if (pumpEvents[e].on & bit) {
+                if (on >= 0) {
+                    fail(round, "pump switched on twice");
+                }
+                on = e;
+            }
+            if (pumpEvents[e].off & bit) {
+                if (off >= 0) {
+                    fail(round, "pump switched off twice");
+                }
+                off = e;
+            }
+        }
+
+        if ((on < 0) || (off < 0) || (off <= on)) {
+            fail(round, "pump not switched on before off");
+            continue;
+        }
+        if ((pumpEvents[off].time - pumpEvents[on].time) != recipe[i].time) {
+            fail(round, "duration changed");
+        }
+        if (exactStart && (pumpEvents[on].time != recipe[i].delay)) {
+            fail(round, "start is not the delay");
+        }
+    }
+
+    // the last event of the recipe marks its end
+    uint8_t last = first;
+    for (uint8_t e = first; e < pumpEventCount; e++) {
+        for (uint8_t i = 0; i < count; i++) {
+            if ((pumpEvents[e].on | pumpEvents[e].off) & PUMP_MASK(recipe[i].pump)) {
+                last = e;
+            }
+        }
+    }
+    for (uint8_t e = first; e < pumpEventCount; e++) {
+        if (((pumpEvents[e].done & (1 << slot)) != 0) != (e == last)) {
+            fail(round, "end of recipe not marked at its last event");
+        }
+    }
+}
+
+static void checkSorted(uint32_t round) {
+    if (pumpEventCount > PUMP_MAX_EVENTS) {
+        fail(round, "too many events");
+    }
+    for (uint8_t e = 1; e < pumpEventCount; e++) {
+        if (pumpEvents[e].time <= pumpEvents[e - 1].time) {
+            fail(round, "events not sorted");
+        }
+    }
+    for (uint8_t e = 0; e < pumpEventCount; e++) {
+        if ((pumpEvents[e].on & pumpEvents[e].off) || !(pumpEvents[e].on | pumpEvents[e].off)) {
+            fail(round, "event switches nothing or both ways");
+        }
+    }
+}
+
+int main(void) {
+    uint32_t events = 0, merged = 0;
+    srand(7);
+
+    for (uint32_t round = 0; round < ROUNDS; round++) {
+        simReset();
+
+        uint8_t weighted = (round % 4) == 3;
+        if (weighted) {
+            uint8_t weight[20];
+            for (uint8_t i = 0; i < 20; i++) {
+                weight[i] = 1 + (rand() % 3);
+            }
+            pumpsSetBudget(6, weight);
+        }
+        uint8_t align = rand() % 3;
+
+        // the second slot gets the other pumps
+        uint32_t half = (rand() % 2) ? 0x003FFul : 0xFFC00ul;
+        uint32_t available = (round % 2) ? half : PUMPS_ALL_MASK;
+
+        RecipeIngredient a[RECIPE_MAX_INGREDIENTS], copy[RECIPE_MAX_INGREDIENTS];
+        uint8_t na = randomRecipe(a, available);
+        memcpy(copy, a, sizeof(a));
+
+        if (pumpsRecipe(0, a, na, align) != STATUS_OK) {
+            fail(round, "recipe rejected");
+            continue;
+        }
+        if (memcmp(copy, a, sizeof(a)) != 0) {
+            fail(round, "recipe changed");
+        }
+
+        checkSorted(round);
+        checkRecipe(round, a, na, 0, 0, !weighted && (align == RECIPE_ALIGN_START));
+        events += pumpEventCount;
+
+        if (round % 2) {
+            // play some of the first recipe, then add the second one
+            uint32_t ms = rand() % 300;
+            for (uint32_t s = 0; s < (ms * PUMP_DMA_TICKS_PER_MS); s++) {
+                simStep();
+            }
+
+            uint32_t absolute[PUMP_MAX_EVENTS];
+            uint8_t left = 0;
+            for (uint8_t e = pumpEventNext; e < pumpEventCount; e++) {
+                absolute[left++] = pumpStartTime + pumpEvents[e].time;
+            }
+
+            RecipeIngredient b[RECIPE_MAX_INGREDIENTS];
+            uint8_t nb = randomRecipe(b, PUMPS_ALL_MASK & ~half);
+            if (pumpsRecipe(1, b, nb, rand() % 3) != STATUS_OK) {
+                fail(round, "second recipe rejected");
+                continue;
+            }
+
+            // the played events are dropped, everything else is still
+            // there at the same time. events due right away are played.
+            checkSorted(round);
+            checkRecipe(round, b, nb, 1, 0, 0);
+            uint8_t found = 0;
+            for (uint8_t e = 0; e < pumpEventCount; e++) {
+                uint32_t mask = pumpEvents[e].on | pumpEvents[e].off;
+                for (uint8_t i = 0; i < na; i++) {
+                    if ((mask & PUMP_MASK(a[i].pump))
+                            && ((pumpStartTime + pumpEvents[e].time) == absolute[found])) {
+                        found++;
+                        break;
+                    }
+                }
+                if (found >= left) {
+                    break;
+                }
+            }
+            if (found != left) {
+                fail(round, "events of the running recipe moved");
+            }
+            merged++;
+        }
+
+        // play to the end, each slot reports its end once
+        uint8_t finished = 0, slot;
+        while (pumpsDispensing()) {
+            simStep();
+
+            // an event may be due a moment before it is played
+            uint32_t running = pumpsRunningMask();
+            for (uint8_t p = 1; p <= 20; p++) {
+                if ((running & PUMP_MASK(p)) && (pumpsRemaining(p) > 300)) {
+                    fail(round, "remaining time out of range");
+                }
+            }
+        }
+        pumpsTask();
+        while (pumpsFinished(&slot) == PUMPS_FINISHED_RECIPE) {
+            finished |= 1 << slot;
+        }
+        if ((finished != ((round % 2) ? 0x03 : 0x01)) || (pumpsRunningMask() != 0)
+                || (simPorts() != 0) || (simLights != 0) || simDmaLent) {
+            fail(round, "not finished properly");
+        }
+    }
+
+    printf("%lu events checked, %lu recipes merged\n", (unsigned long)events,
+            (unsigned long)merged);
+
+    if (errors > 0) {
+        printf("pumps_timeline: FAILED\n");
+        return 1;
+    }
+
+    printf("pumps_timeline: OK\n");
+    return 0;
+}
+
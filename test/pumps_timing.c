@@ -0,0 +1,125 @@
+/*
+ * pumps_timing.c
+ * avr_pump_board
+ *
+ * Host test of the pump timing, stepping the simulated hardware one TCD0
+ * tick at a time. For random recipes aligned to their start, every pump has
+ * to be switched on at its delay and off after its time, both within one
+ * tick. Durations longer than PUMP_DMA_MAX_PERIOD are included, so periods
+ * are split. This is run with the DMA player and with the one-shot timer
+ * used when the lights do not lend their DMA channel.
+ *
+ * Copyright (c) 2017 Thomas Buck <xythobuz@xythobuz.de>
+ * All rights reserved.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "pumps_sim.h"
+
+#define ROUNDS 300
+
+static uint32_t errors = 0;
+static uint64_t worst = 0;
+
+static void fail(uint32_t round, uint8_t pump, const char *what) {
+    if (errors++ < 10) {
+        printf("FAIL: round %lu: pump %d %s\n", (unsigned long)round, pump, what);
+    }
+}
+
+static uint64_t distance(uint64_t a, uint64_t b) {
+    return (a > b) ? (a - b) : (b - a);
+}
+
+static void checkTime(uint32_t round, uint8_t pump, uint64_t actual, uint64_t expected,
+        const char *what) {
+    uint64_t error = distance(actual, expected);
+    if (error > worst) {
+        worst = error;
+    }
+    if (error > SIM_TICKS_PER_STEP) {
+        fail(round, pump, what);
+    }
+}
+
+static uint8_t randomRecipe(RecipeIngredient *recipe) {
+    uint8_t count = 0;
+    for (uint8_t p = 1; (p <= 20) && (count < RECIPE_MAX_INGREDIENTS); p++) {
+        if (rand() % 2) {
+            recipe[count].pump = p;
+            recipe[count].time = (rand() % 4) ? (1 + (rand() % 100)) : (1 + (rand() % 2000));
+            recipe[count].delay = (rand() % 2) ? 0 : (rand() % 1200);
+            count++;
+        }
+    }
+
+    if (count == 0) {
+        recipe[0].pump = 1 + (rand() % 20);
+        recipe[0].time = 1 + (rand() % 2000);
+        recipe[0].delay = rand() % 1200;
+        count = 1;
+    }
+    return count;
+}
+
+static void run(uint8_t dma) {
+    for (uint32_t round = 0; round < ROUNDS; round++) {
+        simReset();
+        simDmaFree = dma;
+
+        // start anywhere within a millisecond
+        for (uint32_t s = rand() % (10 * PUMP_DMA_TICKS_PER_MS); s > 0; s--) {
+            simStep();
+        }
+
+        RecipeIngredient recipe[RECIPE_MAX_INGREDIENTS];
+        uint8_t count = randomRecipe(recipe);
+        uint64_t start = simNow;
+        if (pumpsRecipe(0, recipe, count, RECIPE_ALIGN_START) != STATUS_OK) {
+            fail(round, 0, "recipe rejected");
+            continue;
+        }
+        simSample();
+
+        if (simDmaLent != dma) {
+            fail(round, 0, dma ? "did not use the DMA" : "used the DMA");
+        }
+
+        while (pumpsDispensing()) {
+            simStep();
+        }
+
+        for (uint8_t i = 0; i < count; i++) {
+            uint8_t p = recipe[i].pump;
+            uint64_t on = start + (recipe[i].delay * SIM_TICKS_PER_MS);
+            checkTime(round, p, simOnAt[p], on, "switched on late or early");
+            checkTime(round, p, simOffAt[p], on + (recipe[i].time * SIM_TICKS_PER_MS),
+                    "switched off late or early");
+        }
+
+        if (simPorts() != 0) {
+            fail(round, 0, "still running");
+        }
+        pumpsTask();
+    }
+}
+
+int main(void) {
+    srand(3);
+    run(1);
+    run(0);
+
+    printf("%d recipes, worst error %luus\n", 2 * ROUNDS,
+            (unsigned long)(worst / (SIM_TICKS_PER_MS / 1000)));
+
+    if (errors > 0) {
+        printf("pumps_timing: FAILED\n");
+        return 1;
+    }
+
+    printf("pumps_timing: OK\n");
+    return 0;
+}
+
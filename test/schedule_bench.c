@@ -0,0 +1,211 @@
+/*
+ * schedule_bench.c
+ * avr_pump_board
+ *
+ * Host benchmark of scheduleRecipe(). For random small recipes and power
+ * budgets, the schedule has to respect the delays and the budget, and its
+ * makespan is compared to the optimum found by brute force. Every order of
+ * the ingredients is tried, each one started at the earliest time it fits,
+ * which reaches an optimal schedule for one of them. Finally the time to
+ * schedule a full recipe is measured.
+ *
+ * Copyright (c) 2017 Thomas Buck <xythobuz@xythobuz.de>
+ * All rights reserved.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "config.h"
+#include "schedule.h"
+
+#define ROUNDS 2000
+#define MAX_BRUTE_FORCE ((RECIPE_MAX_INGREDIENTS < 7) ? RECIPE_MAX_INGREDIENTS : 7)
+#define SPEED_ROUNDS 20000
+
+// Allowed average distance from the optimum
+#define MAX_AVERAGE_RATIO 1.02
+
+static RecipeIngredient recipe[RECIPE_MAX_INGREDIENTS];
+static uint8_t weight[20];
+static uint16_t budget;
+static uint8_t count;
+
+static uint32_t start[RECIPE_MAX_INGREDIENTS];
+static uint8_t placed[RECIPE_MAX_INGREDIENTS];
+static uint32_t best;
+
+static uint32_t errors = 0;
+
+static void fail(uint32_t round, const char *what) {
+    if (errors++ < 10) {
+        printf("FAIL: round %lu: %s\n", (unsigned long)round, what);
+    }
+}
+
+// Power drawn at time t by the placed ingredients
+static uint16_t levelAt(uint32_t t) {
+    uint16_t level = 0;
+    for (uint8_t i = 0; i < count; i++) {
+        if (placed[i] && (start[i] <= t) && (t < (start[i] + recipe[i].time))) {
+            level += weight[recipe[i].pump - 1];
+        }
+    }
+    return level;
+}
+
+// The level only rises where an ingredient starts
+static uint8_t fits(uint8_t j, uint32_t s) {
+    uint32_t end = s + recipe[j].time;
+    uint16_t w = weight[recipe[j].pump - 1];
+    if ((levelAt(s) + w) > budget) {
+        return 0;
+    }
+    for (uint8_t i = 0; i < count; i++) {
+        if (placed[i] && (start[i] > s) && (start[i] < end) && ((levelAt(start[i]) + w) > budget)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Earliest start of ingredient j, at its delay or when another one ends
+static uint32_t earliest(uint8_t j) {
+    uint32_t s = UINT32_MAX;
+    if (fits(j, recipe[j].delay)) {
+        s = recipe[j].delay;
+    }
+    for (uint8_t i = 0; i < count; i++) {
+        uint32_t end = start[i] + recipe[i].time;
+        if (placed[i] && (end > recipe[j].delay) && (end < s) && fits(j, end)) {
+            s = end;
+        }
+    }
+    return s;
+}
+
+static void bruteForce(uint8_t depth, uint32_t makespan) {
+    if (makespan >= best) {
+        return;
+    }
+    if (depth == count) {
+        best = makespan;
+        return;
+    }
+    for (uint8_t j = 0; j < count; j++) {
+        if (!placed[j]) {
+            start[j] = earliest(j);
+            placed[j] = 1;
+            uint32_t end = start[j] + recipe[j].time;
+            bruteForce(depth + 1, (end > makespan) ? end : makespan);
+            placed[j] = 0;
+        }
+    }
+}
+
+static void randomRecipe(uint8_t n) {
+    count = n;
+    budget = 1 + (rand() % 6);
+    for (uint8_t i = 0; i < 20; i++) {
+        weight[i] = 1 + (rand() % budget);
+    }
+    for (uint8_t i = 0; i < count; i++) {
+        recipe[i].pump = i + 1;
+        recipe[i].time = 100 + (rand() % 5000);
+        recipe[i].delay = ((rand() % 3) == 0) ? (rand() % 2000) : 0;
+    }
+}
+
+// The schedule from scheduleRecipe() in start has to be valid
+static uint8_t checkSchedule(uint32_t round, uint32_t end) {
+    uint8_t valid = 1;
+    uint32_t makespan = 0;
+    for (uint8_t i = 0; i < count; i++) {
+        if (start[i] < recipe[i].delay) {
+            fail(round, "ingredient starts before its delay");
+            valid = 0;
+        }
+        if ((start[i] + recipe[i].time) > makespan) {
+            makespan = start[i] + recipe[i].time;
+        }
+        placed[i] = 1;
+    }
+    if (makespan != end) {
+        fail(round, "returned end is not the makespan");
+        valid = 0;
+    }
+    for (uint8_t i = 0; i < count; i++) {
+        if (levelAt(start[i]) > budget) {
+            fail(round, "budget exceeded");
+            valid = 0;
+            break;
+        }
+    }
+    for (uint8_t i = 0; i < count; i++) {
+        placed[i] = 0;
+    }
+    return valid;
+}
+
+int main(void) {
+    uint32_t optimal = 0;
+    double sum = 0.0, worst = 1.0;
+    srand(1);
+
+    for (uint32_t round = 0; round < ROUNDS; round++) {
+        randomRecipe(2 + (rand() % (MAX_BRUTE_FORCE - 1)));
+
+        uint32_t end = scheduleRecipe(recipe, count, RECIPE_ALIGN_START, weight, budget,
+                NULL, 0, start);
+        if (end == 0) {
+            fail(round, "no schedule");
+            continue;
+        }
+        if (!checkSchedule(round, end)) {
+            continue;
+        }
+
+        best = UINT32_MAX;
+        bruteForce(0, 0);
+        if (end < best) {
+            fail(round, "better than the optimum");
+        }
+
+        double ratio = (double)end / best;
+        sum += ratio;
+        if (ratio > worst) {
+            worst = ratio;
+        }
+        if (end == best) {
+            optimal++;
+        }
+    }
+
+    printf("%lu of %d optimal, makespan %.4f on average, %.4f at worst\n",
+            (unsigned long)optimal, ROUNDS, sum / ROUNDS, worst);
+    if ((sum / ROUNDS) > MAX_AVERAGE_RATIO) {
+        printf("FAIL: average above %.2f of the optimum\n", MAX_AVERAGE_RATIO);
+        errors++;
+    }
+
+    // Time for the largest recipe
+    randomRecipe(RECIPE_MAX_INGREDIENTS);
+    clock_t begin = clock();
+    for (uint32_t r = 0; r < SPEED_ROUNDS; r++) {
+        scheduleRecipe(recipe, count, RECIPE_ALIGN_START, weight, budget, NULL, 0, start);
+    }
+    double seconds = (double)(clock() - begin) / CLOCKS_PER_SEC;
+    printf("%.2f us for %d ingredients on the host\n", seconds * 1e6 / SPEED_ROUNDS,
+            RECIPE_MAX_INGREDIENTS);
+
+    if (errors > 0) {
+        printf("schedule_bench: FAILED\n");
+        return 1;
+    }
+
+    printf("schedule_bench: OK\n");
+    return 0;
+}
+
@@ -0,0 +1,135 @@
+/*
+ * serial_baud.c
+ * avr_pump_board
+ *
+ * Host test of serialBaudCalculate() against the baudrate formulas of the
+ * XMEGA A manual. Every returned setting has to produce the reported rate,
+ * and no other BSEL, BSCALE and CLK2X combination may come noticeably
+ * closer to the requested rate.
+ *
+ * Copyright (c) 2017 Thomas Buck <xythobuz@xythobuz.de>
+ * All rights reserved.
+ */
+
+#include <math.h>
+#include <stdio.h>
+
+#include <avr/io.h>
+
+#include "serial.h"
+
+// Allowed distance from the best possible setting, relative to the rate.
+// The firmware compares whole Hz, which adds 1 / rate at very low rates.
+#define OPTIMUM_SLACK 0.0002
+
+static uint32_t errors = 0;
+
+// fbaud = fper / (2^BSCALE * S * (BSEL + 1))    for BSCALE >= 0
+// fbaud = fper / (S * (2^BSCALE * BSEL + 1))    for BSCALE < 0
+static double datasheetRate(uint16_t bsel, int8_t bscale, uint8_t clk2x) {
+    double s = clk2x ? 8.0 : 16.0;
+    if (bscale >= 0) {
+        return F_CPU / (ldexp(1.0, bscale) * s * (bsel + 1));
+    } else {
+        return F_CPU / (s * (ldexp(1.0, bscale) * bsel + 1));
+    }
+}
+
+static double bestError(uint32_t rate) {
+    double best = 1e9;
+    for (uint8_t clk2x = 0; clk2x <= 1; clk2x++) {
+        for (int8_t bscale = -7; bscale <= 7; bscale++) {
+            for (uint16_t bsel = 0; bsel <= 0x0FFF; bsel++) {
+                double e = fabs(datasheetRate(bsel, bscale, clk2x) - rate) / rate;
+                if (e < best) {
+                    best = e;
+                }
+            }
+        }
+    }
+    return best;
+}
+
+static void check(uint32_t rate, uint8_t compareOptimum) {
+    SerialBaud baud = { 0 };
+    uint8_t result = serialBaudCalculate(rate, &baud);
+    double actual = datasheetRate(baud.bsel, baud.bscale, baud.clk2x);
+    double error = (actual - rate) / rate;
+
+    if ((baud.bsel > 0x0FFF) || (baud.bscale < -7) || (baud.bscale > 7)) {
+        printf("FAIL: %lu: setting out of range\n", (unsigned long)rate);
+        errors++;
+        return;
+    }
+
+    if (fabs(actual - baud.rate) > 1.0) {
+        printf("FAIL: %lu: reports %lu, datasheet gives %.1f\n",
+                (unsigned long)rate, (unsigned long)baud.rate, actual);
+        errors++;
+    }
+
+    // The error is derived from the rounded rate and truncated to 0.01%
+    if (fabs((error * 10000.0) - baud.error) > (1.0 + (5000.0 / rate))) {
+        printf("FAIL: %lu: reports error %d, datasheet gives %.2f\n",
+                (unsigned long)rate, baud.error, error * 10000.0);
+        errors++;
+    }
+
+    if (result != (fabs(error * 10000.0) > (SERIAL_BAUD_MAX_ERROR + 1))) {
+        printf("FAIL: %lu: returned %d with error %.2f\n",
+                (unsigned long)rate, result, error * 10000.0);
+        errors++;
+    }
+
+    if (compareOptimum) {
+        double best = bestError(rate);
+        if (fabs(error) > (best + OPTIMUM_SLACK + (1.0 / rate))) {
+            printf("FAIL: %lu: error %.4f%%, optimum %.4f%%\n",
+                    (unsigned long)rate, error * 100.0, best * 100.0);
+            errors++;
+        }
+    }
+}
+
+int main(void) {
+    static const uint32_t common[] = {
+        1200, 2400, 4800, 9600, 19200, 38400, 57600, 115200, 230400,
+        250000, 460800, 500000, 921600, 1000000, 2000000
+    };
+
+    for (uint8_t i = 0; i < (sizeof(common) / sizeof(common[0])); i++) {
+        check(common[i], 1);
+    }
+
+    uint32_t rates = 0;
+    for (double rate = 110; rate < 4000000; rate *= 1.03) {
+        check(rate, 1);
+        rates++;
+    }
+
+    // Too fast for even the double speed mode
+    SerialBaud baud;
+    if (serialBaudCalculate(F_CPU, &baud) == 0) {
+        printf("FAIL: F_CPU accepted as baudrate\n");
+        errors++;
+    }
+
+    // The registers take BSCALE as 4 bit two's complement
+    serialSetBaud(SERIAL_UART, &(SerialBaud){ .bsel = 0x0ABC, .bscale = -3 });
+    if ((USARTC1.BAUDCTRLA != 0xBC) || (USARTC1.BAUDCTRLB != 0xDA)
+            || (USARTC1.CTRLB & USART_CLK2X_bm)) {
+        printf("FAIL: register layout\n");
+        errors++;
+    }
+
+    printf("%lu rates compared\n", (unsigned long)(rates + sizeof(common) / sizeof(common[0])));
+
+    if (errors > 0) {
+        printf("serial_baud: FAILED\n");
+        return 1;
+    }
+
+    printf("serial_baud: OK\n");
+    return 0;
+}
+
@@ -0,0 +1,89 @@
+/*
+ * serial_bench.c
+ * avr_pump_board
+ *
+ * Host microbenchmark of serialWriteBuffer() against writing the same text
+ * with one serialWrite() per character. The DMA channel is emulated and
+ * drained whenever the ring is full, so both runs produce the same byte
+ * stream, which is compared as well.
+ *
+ * Copyright (c) 2017 Thomas Buck <xythobuz@xythobuz.de>
+ * All rights reserved.
+ */
+
+#include <stdio.h>
+#include <time.h>
+
+#include "../src/serial.c"
+
+#define ROUNDS 20000
+#define OUT_SIZE (2UL * 1024UL * 1024UL)
+
+static uint8_t out[2][OUT_SIZE];
+static uint32_t outCount[2];
+static uint8_t run;
+
+static const char text[] = "p3d1500w200 p7d800\n"
+        "Pump 12 done after 1500ms\n"
+        "unknown command, try h\n";
+
+// Copy the running transfer out of the ring, like the DMA controller would
+static void dmaComplete(void) {
+    while (SERIALDMATXCHANNEL.CTRLA & DMA_CH_ENABLE_bm) {
+        uint16_t len = SERIALDMATXCHANNEL.TRFCNT;
+        for (uint16_t i = 0; i < len; i++) {
+            if (outCount[run] < OUT_SIZE) {
+                out[run][outCount[run]++] = txBuffer[0][txRead[0] + i];
+            }
+        }
+
+        SERIALDMATXCHANNEL.CTRLA &= ~DMA_CH_ENABLE_bm;
+        SERIALDMATXINTERRUPT();
+    }
+}
+
+static double measure(uint8_t buffered) {
+    run = buffered;
+    outCount[run] = 0;
+    serialInit(SERIAL_UART, 0);
+
+    clock_t start = clock();
+    for (uint32_t r = 0; r < ROUNDS; r++) {
+        // Keep room for one more text, so the writes never block
+        dmaComplete();
+
+        if (buffered) {
+            serialWriteBuffer(SERIAL_UART, (const uint8_t *)text, sizeof(text) - 1);
+        } else {
+            for (uint16_t i = 0; i < (sizeof(text) - 1); i++) {
+                serialWrite(SERIAL_UART, text[i]);
+            }
+        }
+    }
+    dmaComplete();
+    clock_t end = clock();
+
+    return (double)(end - start) * 1e9 / CLOCKS_PER_SEC / outCount[run];
+}
+
+int main(void) {
+    // Warm up caches and branch predictors first
+    measure(0);
+    measure(1);
+
+    double single = measure(0);
+    double buffer = measure(1);
+
+    printf("serialWrite:       %6.2f ns/byte\n", single);
+    printf("serialWriteBuffer: %6.2f ns/byte (%.1fx)\n", buffer, single / buffer);
+
+    if ((outCount[0] != outCount[1])
+            || (memcmp(out[0], out[1], outCount[0]) != 0)) {
+        printf("serial_bench: FAILED, output differs\n");
+        return 1;
+    }
+
+    printf("serial_bench: OK\n");
+    return 0;
+}
+
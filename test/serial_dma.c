@@ -0,0 +1,141 @@
+/*
+ * serial_dma.c
+ * avr_pump_board
+ *
+ * Host test of the DMA transmit path of the serial driver. The DMA channel is
+ * emulated by copying the programmed span out of the ring buffer, so the
+ * test sees the bytes in the order they would leave the UART. Writes of
+ * random length, partly while a transfer is still running, make the ring
+ * wrap around at every possible position.
+ *
+ * Copyright (c) 2017 Thomas Buck <xythobuz@xythobuz.de>
+ * All rights reserved.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../src/serial.c"
+
+#define ROUNDS 200000
+#define SENT_SIZE (4 * TX_BUFFER_SIZE)
+
+static uint8_t expected[SENT_SIZE];
+static uint32_t expectedCount = 0;
+static uint32_t sentCount = 0;
+static uint32_t errors = 0;
+static uint32_t bytesTotal = 0;
+static uint32_t transfers = 0;
+static uint32_t wraps = 0;
+
+static void fail(const char *what) {
+    if (errors++ < 10) {
+        printf("FAIL: %s (after %lu bytes)\n", what, (unsigned long)bytesTotal);
+    }
+}
+
+// Complete the running transfer like the DMA controller would
+static void dmaComplete(void) {
+    if (!(SERIALDMATXCHANNEL.CTRLA & DMA_CH_ENABLE_bm)) {
+        return;
+    }
+
+    uint16_t read = txRead[0];
+    uint16_t len = SERIALDMATXCHANNEL.TRFCNT;
+    uint16_t src = SERIALDMATXCHANNEL.SRCADDR0 | (SERIALDMATXCHANNEL.SRCADDR1 << 8);
+
+    // Only the low address bits exist on the host, compare those
+    if (src != (uint16_t)(uintptr_t)&txBuffer[0][read]) {
+        fail("source address is not the read position");
+    }
+    if ((len == 0) || ((read + len) > TX_BUFFER_SIZE)) {
+        fail("transfer leaves the ring buffer");
+        len = 0;
+    }
+    if ((read + len) == TX_BUFFER_SIZE) {
+        wraps++;
+    }
+
+    for (uint16_t i = 0; i < len; i++) {
+        if (sentCount >= expectedCount) {
+            fail("more bytes sent than written");
+            break;
+        }
+        if (txBuffer[0][read + i] != expected[sentCount % SENT_SIZE]) {
+            fail("byte order differs");
+        }
+        sentCount++;
+        bytesTotal++;
+    }
+    transfers++;
+
+    SERIALDMATXCHANNEL.CTRLA &= ~DMA_CH_ENABLE_bm;
+    SERIALDMATXINTERRUPT();
+}
+
+static void expect(uint8_t c) {
+    expected[expectedCount % SENT_SIZE] = c;
+    expectedCount++;
+}
+
+int main(void) {
+    serialInit(SERIAL_UART, 0);
+    srand(1);
+
+    for (uint32_t r = 0; r < ROUNDS; r++) {
+        // Room left in the ring, keeping the slot that tells full from empty
+        uint16_t queued = (uint16_t)(expectedCount - sentCount);
+        uint16_t space = TX_BUFFER_SIZE - 1 - queued;
+
+        uint8_t buf[TX_BUFFER_SIZE];
+        uint16_t len = 0;
+        uint16_t needed = 0;
+        uint16_t want = rand() % (TX_BUFFER_SIZE / 2);
+        while ((len < want) && (needed < space)) {
+            uint8_t c = ((rand() % 8) == 0) ? '\n' : ('a' + (rand() % 26));
+            if ((c == '\n') && ((needed + 2) > space)) {
+                break;
+            }
+            buf[len++] = c;
+            needed += (c == '\n') ? 2 : 1;
+        }
+
+        for (uint16_t i = 0; i < len; i++) {
+            if (buf[i] == '\n') {
+                expect('\r');
+            }
+            expect(buf[i]);
+        }
+
+        serialWriteBuffer(SERIAL_UART, buf, len);
+
+        // Let the DMA finish only now and then, so writes queue up behind it
+        if ((rand() % 3) == 0) {
+            dmaComplete();
+        }
+    }
+
+    while (SERIALDMATXCHANNEL.CTRLA & DMA_CH_ENABLE_bm) {
+        dmaComplete();
+    }
+
+    if (sentCount != expectedCount) {
+        fail("bytes left in the ring buffer");
+    }
+    if (!shouldStartTransmission[0] || !serialTxBufferEmpty(SERIAL_UART)) {
+        fail("driver not idle at the end");
+    }
+
+    printf("%lu bytes in %lu transfers, %lu ending at the ring end\n",
+            (unsigned long)bytesTotal, (unsigned long)transfers,
+            (unsigned long)wraps);
+
+    if ((errors > 0) || (wraps == 0)) {
+        printf("serial_dma: FAILED\n");
+        return 1;
+    }
+
+    printf("serial_dma: OK\n");
+    return 0;
+}
+
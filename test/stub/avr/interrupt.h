@@ -0,0 +1,22 @@
+/*
+ * interrupt.h
+ * avr_pump_board
+ *
+ * Host stand-in for <avr/interrupt.h>. An ISR becomes a plain function named
+ * after its vector, so a test can raise an interrupt by calling it.
+ *
+ * Copyright (c) 2017 Thomas Buck <xythobuz@xythobuz.de>
+ * All rights reserved.
+ */
+
+#ifndef _stub_avr_interrupt_h
+#define _stub_avr_interrupt_h
+
+#define ISR(vector, ...) void vector(void); void vector(void)
+#define ISR_NOBLOCK
+
+#define sei() ((void)0)
+#define cli() ((void)0)
+
+#endif // _stub_avr_interrupt_h
+
@@ -0,0 +1,252 @@
+/*
+ * io.h
+ * avr_pump_board
+ *
+ * Host stand-in for <avr/io.h>. Only the ATxmega128A1 peripherals and bit
+ * names used by the firmware are declared. The registers are plain variables
+ * defined in registers.c, so a test can inspect and poke them.
+ *
+ * Copyright (c) 2017 Thomas Buck <xythobuz@xythobuz.de>
+ * All rights reserved.
+ */
+
+#ifndef _stub_avr_io_h
+#define _stub_avr_io_h
+
+#include <stdint.h>
+
+#define __AVR_ATxmega128A1__ 1
+#define __AVR_ARCH__ 106
+#define RAMEND 0x3FFF
+#define _PROTECTED_WRITE(r, v) ((r) = (v))
+
+typedef volatile uint8_t register8_t;
+typedef volatile uint16_t register16_t;
+
+typedef struct {
+    register8_t DIR, DIRSET, DIRCLR, DIRTGL, OUT, OUTSET, OUTCLR, OUTTGL, IN,
+        INTCTRL, INT0MASK, INT1MASK, INTFLAGS, r0, r1, r2, PIN0CTRL,
+        PIN1CTRL, PIN2CTRL, PIN3CTRL, PIN4CTRL, PIN5CTRL, PIN6CTRL, PIN7CTRL;
+} PORT_t;
+
+typedef struct {
+    register8_t DIR, OUT, IN, INTFLAGS;
+} VPORT_t;
+
+typedef struct {
+    register8_t DATA, STATUS, reserved, CTRLA, CTRLB, CTRLC, BAUDCTRLA,
+        BAUDCTRLB;
+} USART_t;
+
+typedef struct {
+    register8_t CTRLA, CTRLB, ADDRCTRL, TRIGSRC;
+    register16_t TRFCNT;
+    register8_t REPCNT, r, SRCADDR0, SRCADDR1, SRCADDR2, r2, DESTADDR0,
+        DESTADDR1, DESTADDR2;
+} DMA_CH_t;
+
+typedef struct {
+    register8_t CTRL, INTFLAGS, STATUS;
+    register16_t TEMP;
+    DMA_CH_t CH0, CH1, CH2, CH3;
+} DMA_t;
+
+typedef struct {
+    register8_t CTRLA, CTRLB, CTRLC, CTRLD, CTRLE, INTCTRLA, INTCTRLB,
+        CTRLFCLR, CTRLFSET, CTRLGCLR, CTRLGSET, INTFLAGS;
+    register16_t TEMP, CNT, PER, CCA, CCB, CCC, CCD, PERBUF, CCABUF, CCBBUF,
+        CCCBUF, CCDBUF;
+} TC0_t;
+
+typedef struct {
+    register8_t CTRLA, CTRLB, CTRLC, CTRLD, CTRLE, INTCTRLA, INTCTRLB,
+        CTRLFCLR, CTRLFSET, CTRLGCLR, CTRLGSET, INTFLAGS;
+    register16_t TEMP, CNT, PER, CCA, CCB, PERBUF, CCABUF, CCBBUF;
+} TC1_t;
+
+typedef struct {
+    register8_t CH0MUX, CH1MUX, CH2MUX, CH3MUX, CH4MUX, CH5MUX, CH6MUX,
+        CH7MUX, CH0CTRL, CH1CTRL, CH2CTRL, CH3CTRL, CH4CTRL, CH5CTRL,
+        CH6CTRL, CH7CTRL, STROBE, DATA;
+} EVSYS_t;
+
+typedef struct {
+    register8_t STATUS, INTPRI, CTRL;
+} PMIC_t;
+
+typedef struct {
+    register8_t CTRL, STATUS, PLLCTRL;
+} OSC_t;
+
+typedef struct {
+    register8_t CTRL;
+} SLEEP_t;
+
+typedef struct {
+    register8_t VPCTRLA, VPCTRLB;
+} PORTCFG_t;
+
+extern PORT_t PORTA, PORTB, PORTC, PORTD, PORTE, PORTF, PORTH, PORTJ, PORTK,
+    PORTQ;
+extern VPORT_t VPORT0, VPORT1, VPORT2, VPORT3;
+extern USART_t USARTC0, USARTC1;
+extern DMA_t DMA;
+extern EVSYS_t EVSYS;
+extern PMIC_t PMIC;
+extern OSC_t OSC;
+extern SLEEP_t SLEEP;
+extern PORTCFG_t PORTCFG;
+extern TC0_t TCC0, TCD0, TCE0, TCF0;
+extern TC1_t TCC1, TCD1, TCE1, TCF1;
+extern register8_t OSC_PLLCTRL, OSC_CTRL, CLK_PSCTRL, CLK_CTRL, SREG, CCP;
+extern register16_t TCF0_CCCBUF;
+
+#define PIN0_bm 1
+#define PIN1_bm 2
+#define PIN2_bm 4
+#define PIN3_bm 8
+#define PIN4_bm 16
+#define PIN5_bm 32
+#define PIN6_bm 64
+#define PIN7_bm 128
+#define OSC_PLLEN_bm 16
+#define OSC_RC2MEN_bm 1
+#define OSC_XOSCEN_bm 8
+#define OSC_PLLRDY_bm 16
+#define PMIC_LOLVLEN_bm 1
+#define PMIC_MEDLVLEN_bm 2
+#define PMIC_HILVLEN_bm 4
+#define TC0_CLKSEL0_bm 1
+#define TC0_CLKSEL2_bm 4
+#define TC0_CCCEN_bm 0x40
+#define TC0_CCAEN_bm 0x10
+#define TC0_BYTEM_bm 1
+#define TC_WGMODE_SS_gc 3
+#define TC_WGMODE_NORMAL_gc 0
+#define TC_CLKSEL_OFF_gc 0
+#define TC_CLKSEL_DIV1_gc 1
+#define TC_CLKSEL_DIV2_gc 2
+#define TC_CLKSEL_DIV4_gc 3
+#define TC_CLKSEL_DIV8_gc 4
+#define TC_CLKSEL_DIV64_gc 5
+#define TC_CLKSEL_DIV256_gc 6
+#define TC_CLKSEL_DIV1024_gc 7
+#define TC_CLKSEL_EVCH0_gc 8
+#define TC_CLKSEL_EVCH1_gc 9
+#define TC_CLKSEL_EVCH2_gc 10
+#define TC_CLKSEL_EVCH3_gc 11
+#define TC_CLKSEL_EVCH4_gc 12
+#define TC_CLKSEL_EVCH5_gc 13
+#define TC_EVACT_OFF_gc 0
+#define TC_EVSEL_OFF_gc 0
+#define TC_EVACT_CAPT_gc 0x20
+#define TC_EVSEL_CH0_gc 8
+#define TC_EVSEL_CH1_gc 9
+#define TC_EVSEL_CH2_gc 10
+#define TC0_EVDLY_bm 0x10
+#define TC1_EVDLY_bm 0x10
+#define TC_CMD_RESTART_gc 8
+#define TC_CMD_UPDATE_gc 4
+#define TC0_OVFIF_bm 1
+#define TC0_CCAIF_bm 0x10
+#define TC1_OVFIF_bm 1
+#define TC1_CCAIF_bm 0x10
+#define TC_OVFINTLVL_OFF_gc 0
+#define TC_OVFINTLVL_LO_gc 1
+#define TC_OVFINTLVL_MED_gc 2
+#define TC_OVFINTLVL_HI_gc 3
+#define TC_CCAINTLVL_OFF_gc 0
+#define TC_CCAINTLVL_LO_gc 1
+#define TC_CCAINTLVL_MED_gc 2
+#define TC_CCAINTLVL_HI_gc 3
+#define TC0_CCAINTLVL_gm 3
+#define TC1_CCAINTLVL_gm 3
+#define EVSYS_CHMUX_TCF0_OVF_gc 0xF0
+#define EVSYS_CHMUX_TCC0_OVF_gc 0xC0
+#define EVSYS_CHMUX_TCD0_OVF_gc 0xD0
+#define EVSYS_CHMUX_TCE0_OVF_gc 0xE0
+#define EVSYS_CHMUX_TCC1_OVF_gc 0xC8
+#define EVSYS_CHMUX_TCD1_CCA_gc 0xDC
+#define EVSYS_CHMUX_TCD1_OVF_gc 0xD8
+#define DMA_ENABLE_bm 0x80
+#define DMA_RESET_bm 0x40
+#define DMA_DBUFMODE_CH01_gc 4
+#define DMA_CH_ENABLE_bm 0x80
+#define DMA_CH_RESET_bm 0x40
+#define DMA_CH_REPEAT_bm 0x20
+#define DMA_CH_TRFREQ_bm 0x10
+#define DMA_CH_SINGLE_bm 0x04
+#define DMA_CH_BURSTLEN_1BYTE_gc 0
+#define DMA_CH_BURSTLEN_2BYTE_gc 1
+#define DMA_CH_BURSTLEN_4BYTE_gc 2
+#define DMA_CH_BURSTLEN_8BYTE_gc 3
+#define DMA_CH_BUSY_bm 0x80
+#define DMA_CH_PENDING_bm 0x40
+#define DMA_CH_ERRIF_bm 0x20
+#define DMA_CH_TRNIF_bm 0x10
+#define DMA_CH_ERRINTLVL_gp 2
+#define DMA_CH_TRNINTLVL_gp 0
+#define DMA_CH_TRNINTLVL_gm 3
+#define DMA_CH_SRCRELOAD0_bm 0x40
+#define DMA_CH_SRCRELOAD1_bm 0x80
+#define DMA_CH_SRCDIR0_bm 0x10
+#define DMA_CH_SRCRELOAD_NONE_gc 0
+#define DMA_CH_SRCRELOAD_BLOCK_gc 0x40
+#define DMA_CH_SRCRELOAD_BURST_gc 0x80
+#define DMA_CH_SRCRELOAD_TRANSACTION_gc 0xC0
+#define DMA_CH_SRCDIR_FIXED_gc 0
+#define DMA_CH_SRCDIR_INC_gc 0x10
+#define DMA_CH_DESTRELOAD_NONE_gc 0
+#define DMA_CH_DESTRELOAD_BLOCK_gc 4
+#define DMA_CH_DESTRELOAD_BURST_gc 8
+#define DMA_CH_DESTRELOAD_TRANSACTION_gc 0xC
+#define DMA_CH_DESTDIR_FIXED_gc 0
+#define DMA_CH_DESTDIR_INC_gc 1
+#define DMA_CH_TRIGSRC_OFF_gc 0
+#define DMA_CH_TRIGSRC_EVSYS_CH0_gc 1
+#define DMA_CH_TRIGSRC_EVSYS_CH1_gc 2
+#define DMA_CH_TRIGSRC_EVSYS_CH2_gc 3
+#define DMA_CH_TRIGSRC_USARTC0_RXC_gc 0x4B
+#define DMA_CH_TRIGSRC_USARTC0_DRE_gc 0x4C
+#define DMA_CH_TRIGSRC_USARTC1_RXC_gc 0x4E
+#define DMA_CH_TRIGSRC_USARTC1_DRE_gc 0x4F
+#define DMA_CH_TRIGSRC_TCD1_CCA_gc 0x6A
+#define DMA_CH_TRIGSRC_TCD1_OVF_gc 0x66
+#define DMA_CH0BUSY_bm 0x10
+#define DMA_CH1BUSY_bm 0x20
+#define DMA_CH2BUSY_bm 0x40
+#define DMA_CH3BUSY_bm 0x80
+#define DMA_CH0PEND_bm 1
+#define DMA_CH1PEND_bm 2
+#define DMA_CH2PEND_bm 4
+#define DMA_CH3PEND_bm 8
+#define DMA_CH2TRNIF_bm 4
+#define DMA_CH3TRNIF_bm 8
+#define USART_RXCINTLVL_gp 4
+#define USART_TXCINTLVL_gp 2
+#define USART_DREINTLVL_gp 0
+#define USART_RXCIF_bm 0x80
+#define USART_TXCIF_bm 0x40
+#define USART_DREIF_bm 0x20
+#define USART_BUFOVF_bm 0x08
+#define USART_FERR_bm 0x10
+#define USART_CLK2X_bm 0x04
+#define USART_RXEN_bm 0x10
+#define USART_TXEN_bm 0x08
+#define USART_BSCALE_gp 4
+#define SLEEP_SMODE_IDLE_gc 0
+#define SLEEP_SEN_bm 1
+#define PORTCFG_VP0MAP_PORTA_gc 0
+#define PORTCFG_VP1MAP_PORTB_gc 0x10
+#define PORTCFG_VP2MAP_PORTH_gc 7
+#define PORTCFG_VP3MAP_PORTE_gc 4
+#define PORTCFG_VP3MAP_gm 0xF0
+#define EVSYS_CHMUX_OFF_gc 0x00
+#define DMA_DBUFMODE_gm 0x0C
+#define PORT_ISC_FALLING_gc 0x02
+#define PORT_INT0IF_bm 0x01
+#define PORT_INT0LVL_LO_gc 0x01
+#define PORT_INT0LVL_OFF_gc 0x00
+
+#endif // _stub_avr_io_h
+
@@ -0,0 +1,30 @@
+/*
+ * pgmspace.h
+ * avr_pump_board
+ *
+ * Host stand-in for <avr/pgmspace.h>. There is only one address space.
+ *
+ * Copyright (c) 2017 Thomas Buck <xythobuz@xythobuz.de>
+ * All rights reserved.
+ */
+
+#ifndef _stub_avr_pgmspace_h
+#define _stub_avr_pgmspace_h
+
+#include <stdint.h>
+#include <string.h>
+
+#define PROGMEM
+#define PGM_P const char *
+#define PSTR(s) (s)
+
+#define pgm_read_byte(p) (*(const uint8_t *)(p))
+#define pgm_read_word(p) (*(const uint16_t *)(p))
+#define pgm_read_dword(p) (*(const uint32_t *)(p))
+#define pgm_read_ptr(p) (*(void * const *)(p))
+
+#define memcpy_P memcpy
+#define strlen_P strlen
+
+#endif // _stub_avr_pgmspace_h
+
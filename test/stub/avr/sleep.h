@@ -0,0 +1,23 @@
+/*
+ * sleep.h
+ * avr_pump_board
+ *
+ * Host stand-in for <avr/sleep.h>. Sleeping returns immediately.
+ *
+ * Copyright (c) 2017 Thomas Buck <xythobuz@xythobuz.de>
+ * All rights reserved.
+ */
+
+#ifndef _stub_avr_sleep_h
+#define _stub_avr_sleep_h
+
+#define SLEEP_MODE_IDLE 0
+
+#define set_sleep_mode(mode) ((void)0)
+#define sleep_enable() ((void)0)
+#define sleep_disable() ((void)0)
+#define sleep_cpu() ((void)0)
+#define sleep_mode() ((void)0)
+
+#endif // _stub_avr_sleep_h
+
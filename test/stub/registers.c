@@ -0,0 +1,26 @@
+/*
+ * registers.c
+ * avr_pump_board
+ *
+ * Storage for the peripheral registers declared in the host <avr/io.h>.
+ *
+ * Copyright (c) 2017 Thomas Buck <xythobuz@xythobuz.de>
+ * All rights reserved.
+ */
+
+#include <avr/io.h>
+
+PORT_t PORTA, PORTB, PORTC, PORTD, PORTE, PORTF, PORTH, PORTJ, PORTK, PORTQ;
+VPORT_t VPORT0, VPORT1, VPORT2, VPORT3;
+USART_t USARTC0, USARTC1;
+DMA_t DMA;
+EVSYS_t EVSYS;
+PMIC_t PMIC;
+OSC_t OSC;
+SLEEP_t SLEEP;
+PORTCFG_t PORTCFG;
+TC0_t TCC0, TCD0, TCE0, TCF0;
+TC1_t TCC1, TCD1, TCE1, TCF1;
+register8_t OSC_PLLCTRL, OSC_CTRL, CLK_PSCTRL, CLK_CTRL, SREG, CCP;
+register16_t TCF0_CCCBUF;
+
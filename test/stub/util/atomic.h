@@ -0,0 +1,23 @@
+/*
+ * atomic.h
+ * avr_pump_board
+ *
+ * Host stand-in for <util/atomic.h>. The tests are single threaded, so the
+ * blocks only have to run their body once.
+ *
+ * Copyright (c) 2017 Thomas Buck <xythobuz@xythobuz.de>
+ * All rights reserved.
+ */
+
+#ifndef _stub_util_atomic_h
+#define _stub_util_atomic_h
+
+#define ATOMIC_RESTORESTATE 0
+#define ATOMIC_FORCEON 1
+#define NONATOMIC_RESTORESTATE 0
+
+#define ATOMIC_BLOCK(type) for (int _once = 1; _once; _once = 0)
+#define NONATOMIC_BLOCK(type) for (int _once = 1; _once; _once = 0)
+
+#endif // _stub_util_atomic_h
+
@@ -0,0 +1,18 @@
+/*
+ * delay.h
+ * avr_pump_board
+ *
+ * Host stand-in for <util/delay.h>. Busy waits return immediately.
+ *
+ * Copyright (c) 2017 Thomas Buck <xythobuz@xythobuz.de>
+ * All rights reserved.
+ */
+
+#ifndef _stub_util_delay_h
+#define _stub_util_delay_h
+
+#define _delay_ms(ms) ((void)(ms))
+#define _delay_us(us) ((void)(us))
+
+#endif // _stub_util_delay_h
+
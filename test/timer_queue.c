@@ -0,0 +1,161 @@
+/*
+ * timer_queue.c
+ * avr_pump_board
+ *
+ * Host test of the software timers in clock.c. The system time is set by
+ * writing the counters of TimerC0 and TimerC1, and the compare interrupt is
+ * raised by calling it. Timers have to run in deadline order, at ISR level
+ * or deferred to timerLoop(). Timers started from a callback in the ISR
+ * count from its deadline, those started while a deferred callback runs,
+ * for example by another ISR, count from the current time. Cancelling with
+ * a stale id must not touch the timer reusing the slot.
+ *
+ * Copyright (c) 2017 Thomas Buck <xythobuz@xythobuz.de>
+ * All rights reserved.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "../src/clock.c"
+
+#define TICKS_PER_MS CLOCK_TICKS_PER_MS
+
+static char order[32];
+static uint8_t orderLength = 0;
+static uint8_t wakes = 0;
+static uint8_t startedId = TIMER_INVALID;
+
+static uint32_t errors = 0;
+
+void idleWake(void) {
+    wakes++;
+}
+
+static void setTime(uint32_t ms) {
+    uint32_t ticks = ms * TICKS_PER_MS;
+    TCC1.CNT = ticks >> 16;
+    TCC0.CNT = ticks & 0xFFFF;
+}
+
+static void ran(char c) {
+    if (orderLength < (sizeof(order) - 1)) {
+        order[orderLength++] = c;
+        order[orderLength] = '\0';
+    }
+}
+
+static void check(const char *expected, const char *what) {
+    if (strcmp(order, expected) != 0) {
+        printf("FAIL: %s: ran %s, not %s\n", what, order, expected);
+        errors++;
+    }
+    orderLength = 0;
+    order[0] = '\0';
+}
+
+static uint64_t deadlineOf(uint8_t id) {
+    return timers[id & TIMER_SLOT_MASK].deadline;
+}
+
+static void callbackA(void) { ran('A'); }
+static void callbackB(void) { ran('B'); }
+static void callbackC(void) { ran('C'); }
+
+// chained in the ISR, counts from the deadline of B2
+static void callbackB2(void) {
+    ran('b');
+    startedId = timerStart(3, callbackC, 0);
+}
+
+// like an ISR starting a timer while a deferred callback runs
+static void callbackDeferred(void) {
+    ran('D');
+    startedId = timerStart(1, callbackA, 0);
+}
+
+int main(void) {
+    initSystemTimer();
+    TCC1.INTFLAGS = 0; // no overflow pending on the host
+
+    // ISR level timers in deadline order, whatever the order of starting
+    setTime(0);
+    timerStart(30, callbackC, 0);
+    timerStart(10, callbackA, 0);
+    timerStart(20, callbackB, 0);
+    setTime(25);
+    TCC0_CCA_vect();
+    check("AB", "due at 25ms");
+    setTime(30);
+    TCC0_CCA_vect();
+    check("C", "due at 30ms");
+
+    // a timer started from a callback in the ISR counts from its deadline,
+    // so it is due in the same interrupt here
+    timerStart(5, callbackB2, 0);
+    setTime(40);
+    TCC0_CCA_vect();
+    check("bC", "chained in the ISR");
+    if ((startedId == TIMER_INVALID) || (timerCount != 0)) {
+        printf("FAIL: chained timer not run\n");
+        errors++;
+    }
+
+    // deferred timers only run from timerLoop(), in deadline order
+    setTime(100);
+    timerStart(20, callbackB, TIMER_DEFERRED);
+    timerStart(10, callbackA, TIMER_DEFERRED);
+    timerStart(15, callbackC, 0);
+    setTime(130);
+    wakes = 0;
+    TCC0_CCA_vect();
+    check("C", "deferred timers in the ISR");
+    if (wakes != 2) {
+        printf("FAIL: %d wake-ups for 2 deferred timers\n", wakes);
+        errors++;
+    }
+    timerLoop();
+    check("AB", "deferred timers in the loop");
+
+    // started while a deferred callback runs, counts from now
+    setTime(200);
+    timerStart(10, callbackDeferred, TIMER_DEFERRED);
+    setTime(250);
+    TCC0_CCA_vect();
+    timerLoop();
+    check("D", "deferred callback");
+    if ((startedId == TIMER_INVALID) || (deadlineOf(startedId) != (251 * TICKS_PER_MS))) {
+        printf("FAIL: timer started in a deferred callback counts from its deadline\n");
+        errors++;
+    }
+    if (timerFiring) {
+        printf("FAIL: still firing after the deferred callback\n");
+        errors++;
+    }
+    setTime(251);
+    TCC0_CCA_vect();
+    check("A", "started in a deferred callback");
+
+    // a stale id does not cancel the timer reusing its slot
+    setTime(300);
+    uint8_t stale = timerStart(10, callbackA, 0);
+    timerCancel(stale);
+    uint8_t reused = timerStart(10, callbackB, 0);
+    timerCancel(stale);
+    if ((reused & TIMER_SLOT_MASK) != (stale & TIMER_SLOT_MASK)) {
+        printf("FAIL: slot not reused\n");
+        errors++;
+    }
+    setTime(310);
+    TCC0_CCA_vect();
+    check("B", "stale id cancelled");
+
+    if (errors > 0) {
+        printf("timer_queue: FAILED\n");
+        return 1;
+    }
+
+    printf("timer_queue: OK\n");
+    return 0;
+}
+